@@ -21,8 +21,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include<iostream>
 #include<fstream>
 #include<string>
+#include<vector>
 #include<algorithm>
 #include<functional>
+#include<thread>
+#include<queue>
+#include<atomic>
+#include<memory>
 
 #ifdef USE_STD_REGEX
 	#include<regex>
@@ -33,6 +38,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 
 #include<IPAddress.h>
+#include<MappedFile.h>
+#include<OutputBuffer.h>
+#include<RadixSort.h>
+#include<Parallel.h>
+#include<PageAllocator.h>
+#include<InputStream.h>
+#include<Decompress.h>
 
 template<typename T>
 struct IPNode
@@ -44,280 +56,1989 @@ struct IPNode
 		ip(ip_), prefix(prefix_) {};
 };
 
+// Markers at the same address are ordered by type, so that all block starts
+// are counted before block ends.
+
 enum IPMarkerType 
 { 
 	ipm_invalid,
 	ipm_a_open, 
-	ipm_a_close,
 	ipm_b_open, 
+	ipm_a_close,
 	ipm_b_close
 };
 
+inline bool is_open(const IPMarkerType type)
+{
+	return type == ipm_a_open || type == ipm_b_open;
+}
+
 template<typename T>
 struct IPMarker
 {
 	T ip;
 	IPMarkerType type;
 
-	IPMarker() :
-		ip(T()), type(ipm_invalid) {};
+	IPMarker() :
+		ip(T()), type(ipm_invalid) {};
+
+	IPMarker(T ip_, IPMarkerType type_) :
+		ip(ip_), type(type_) {};
+
+	bool operator < (const IPMarker& a) const 
+	{
+		return ip < a.ip || (ip == a.ip && type < a.type);
+	}
+};
+
+// A prefix from one of the inputs, stored as a single record instead of a
+// pair of markers. The first address of the block is kept as bytes in network
+// order, so the record is not padded to the alignment of T (5 bytes for IPv4
+// and 17 bytes for IPv6, compared to 16 and 48 for two markers) and sorts
+// bytewise. Block ends and the markers are derived during the sweep.
+
+template<typename T>
+class IPInterval
+{
+private:
+	uint8_t start_[T::byte_length];
+	uint8_t prefix_;
+
+	friend struct radix_key<IPInterval>;
+public:
+	IPInterval() {};
+
+	IPInterval(const T& start, short prefix) :
+		prefix_(static_cast<uint8_t>(prefix))
+	{
+		start.to_bytes(start_);
+	}
+
+	T start() const { return T::from_bytes(start_); }
+	short prefix() const { return prefix_; }
+	T last() const { return start().network_ones(prefix_); }
+
+	// Larger blocks come first among the ones that start at the same address
+	bool operator < (const IPInterval& a) const
+	{
+		int order = memcmp(start_, a.start_, sizeof(start_));
+		return order < 0 || (order == 0 && prefix_ < a.prefix_);
+	}
+
+	bool operator == (const IPInterval& a) const
+	{
+		return prefix_ == a.prefix_ && memcmp(start_, a.start_, sizeof(start_)) == 0;
+	}
+
+	// Mixes the address four bytes at a time (byte_length is a multiple of four)
+	size_t hash() const
+	{
+		uint64_t hash = prefix_;
+		for (int i = 0; i < T::byte_length; i += 4)
+		{
+			uint32_t word;
+			memcpy(&word, start_ + i, sizeof(word));
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+			hash ^= hash >> 32;
+		}
+		return static_cast<size_t>(hash);
+	}
+};
+
+template<typename T>
+struct radix_key<IPInterval<T>>
+{
+	static const int length = T::byte_length + 1;
+
+	static uint8_t byte(const IPInterval<T>& interval, const int i)
+	{
+		return i < T::byte_length ? interval.start_[i] : interval.prefix_;
+	}
+};
+
+template<typename T>
+using IntervalVector = std::vector<IPInterval<T>, PageAllocator<IPInterval<T>>>;
+
+// Intervals that are stored elsewhere, either in an IntervalVector or in a
+// mapped snapshot (see LoadedInput)
+
+template<typename T>
+class IntervalRange
+{
+private:
+	const IPInterval<T>* begin_;
+	const IPInterval<T>* end_;
+public:
+	IntervalRange() : begin_(nullptr), end_(nullptr) {};
+	IntervalRange(const IPInterval<T>* begin, const IPInterval<T>* end) :
+		begin_(begin), end_(end) {};
+	IntervalRange(const IntervalVector<T>& intervals) :
+		begin_(intervals.data()), end_(intervals.data() + intervals.size()) {};
+
+	const IPInterval<T>* begin() const { return begin_; }
+	const IPInterval<T>* end() const { return end_; }
+	size_t size() const { return end_ - begin_; }
+	const IPInterval<T>& operator [](size_t i) const { return begin_[i]; }
+};
+
+// Set of intervals for comparing exact prefixes, using open addressing with
+// linear probing. The capacity is fixed when the set is created and is kept
+// at least twice the number of elements. Free slots hold an interval with a
+// prefix length that is invalid in every address family.
+
+template<typename T>
+class IntervalSet
+{
+private:
+	static const short free_slot = 0xff;
+
+	IntervalVector<T> slots_;
+	size_t mask_;
+
+	size_t find(const IPInterval<T>& interval) const
+	{
+		size_t slot = interval.hash() & mask_;
+		while (slots_[slot].prefix() != free_slot && !(slots_[slot] == interval))
+			slot = (slot + 1) & mask_;
+		return slot;
+	}
+public:
+	IntervalSet(size_t count)
+	{
+		size_t capacity = 16;
+		while (capacity < 2 * count)
+			capacity *= 2;
+		slots_.assign(capacity, IPInterval<T>(T(), free_slot));
+		mask_ = capacity - 1;
+	}
+
+	// Returns false if the interval is in the set already
+	bool insert(const IPInterval<T>& interval)
+	{
+		size_t slot = find(interval);
+		if (slots_[slot].prefix() != free_slot)
+			return false;
+		slots_[slot] = interval;
+		return true;
+	}
+
+	bool contains(const IPInterval<T>& interval) const
+	{
+		return slots_[find(interval)].prefix() != free_slot;
+	}
+};
+
+// OutputAdapter base class. Output adapters provide a callback function for 
+// `IPNode`s (void operator ()(const IPNode<T>& node) const). They are passed 
+// around as template parameters rather than through virtual functions, so 
+// that the emit path can be inlined into add() and traverse().
+
+template<typename T>
+class OutputAdapter
+{
+public:
+	bool empty() const { return false; };
+};
+
+template<typename T>
+class EmptyOutputAdapter : public OutputAdapter<T>
+{
+public:
+	void operator ()(const IPNode<T>& node) const {};
+	bool empty() const { return true; };
+};
+
+template<typename T>
+class SimpleAdapter : public OutputAdapter<T>
+{
+private:
+	OutputBuffer& output_;
+public:
+	SimpleAdapter(OutputBuffer& output) : output_(output) {};
+
+	void operator ()(const IPNode<T>& node) const 
+	{
+		char text[T::max_string_length];
+		output_.write(text, node.ip.format(text) - text);
+		output_.put('/');
+		output_.write_number(node.prefix);
+		output_.end_line();
+	}
+};
+
+template<typename T>
+class DiffAdapter : public OutputAdapter<T>
+{
+private:
+	OutputBuffer& output_;
+	std::string prefix_;
+public:
+	DiffAdapter(OutputBuffer& output, const std::string& prefix) : 
+		output_(output), prefix_(prefix) {};
+
+	void operator ()(const IPNode<T>& node) const 
+	{
+		char text[T::max_string_length];
+		output_.write(prefix_);
+		output_.write(text, node.ip.format(text) - text);
+		output_.put('/');
+		output_.write_number(node.prefix);
+		output_.end_line();
+	}
+};
+
+template<typename T>
+class AnnotatedAdapter : public OutputAdapter<T>
+{
+private:
+	OutputBuffer& output_;
+	const std::string& annotation_;
+public:
+	AnnotatedAdapter(OutputBuffer& output, const std::string& annotation) : 
+		output_(output), annotation_(annotation) {};
+
+	void operator ()(const IPNode<T>& node) const 
+	{
+		char text[T::max_string_length];
+		output_.write(text, node.ip.format(text) - text);
+		output_.put('/');
+		output_.write_number(node.prefix);
+		output_.put(' ');
+		output_.write(annotation_);
+		output_.end_line();
+	}
+};
+
+// Comparison kernels provide a means to perform different operations on sets
+// (bool operator ()(const int A, const int B) const and static bool symetric()).
+// Like output adapters, they are template parameters of traverse(), so the 
+// count comparison is inlined into the sweep.
+
+class UnionKernel
+{
+public:
+	bool operator ()(const int A, const int B) const 
+	{
+		return A > 0 || B > 0;
+	}
+	static bool symetric() { return true; }
+};
+
+class IntersectionKernel
+{
+public:
+	bool operator ()(const int A, const int B) const 
+	{
+		return A > 0 && B > 0;
+	}
+	static bool symetric() { return true; }
+};
+
+class DifferenceKernel
+{
+public:
+	bool operator ()(const int A, const int B) const 
+	{
+		return A == 0 && B > 0;
+	}
+	static bool symetric() { return false; }
+};
+
+// State of a sweep over any number of sources: the number of open blocks of
+// every source, how many sources have at least one, and the bitmask of those
+// sources (source i is bit i % 64 of mask[i / 64]).
+
+struct SourceCounts
+{
+	std::vector<int> counts;
+	std::vector<uint64_t> mask;
+	size_t present;
+
+	SourceCounts(size_t sources) :
+		counts(sources, 0), mask((sources + 63) / 64, 0), present(0) {};
+
+	size_t size() const { return counts.size(); }
+
+	void update(size_t source, int delta)
+	{
+		bool was_present = counts[source] > 0;
+		counts[source] += delta;
+
+		if (was_present != (counts[source] > 0))
+		{
+			present += was_present ? -1 : 1;
+			mask[source / 64] ^= static_cast<uint64_t>(1) << (source % 64);
+		}
+	}
+};
+
+// Kernels of operations on any number of sources (bool operator ()(const 
+// SourceCounts& sources) const).
+
+class AllKernel
+{
+public:
+	bool operator ()(const SourceCounts& sources) const
+	{
+		return sources.present == sources.size();
+	}
+};
+
+class AtLeastKernel
+{
+private:
+	size_t minimum_;
+public:
+	AtLeastKernel(size_t minimum) : minimum_(minimum) {};
+
+	bool operator ()(const SourceCounts& sources) const
+	{
+		return sources.present >= minimum_;
+	}
+};
+
+class MissingKernel
+{
+public:
+	bool operator ()(const SourceCounts& sources) const
+	{
+		return sources.present > 0 && sources.present < sources.size();
+	}
+};
+
+// Outcome of reading a prefix from a single line. Readers only report the
+// status; the diagnostic is built by invalid_line() if it is needed at all.
+enum LineStatus { line_ignored, line_valid, line_invalid };
+
+// Part of an input file that is read by a single thread, always made of
+// whole lines (or MRT records). For diagnostics, origin is the first byte of
+// the input that is still in memory, which is origin_offset bytes and
+// origin_line lines into the input (both are zero unless it is streamed).
+struct InputChunk
+{
+	const std::string& file_name;
+	const char* origin;
+	const char* begin;
+	const char* end;
+	size_t origin_offset;
+	size_t origin_line;
+};
+
+std::string describe_line(const InputChunk& chunk, const char* begin, const char* end)
+{
+	size_t line_number = chunk.origin_line + std::count(chunk.origin, begin, '\n') + 1;
+	return "line " + std::to_string(static_cast<unsigned long long>(line_number)) +
+		" of " + chunk.file_name + " (" + std::string(begin, end) + ")";
+}
+
+std::string invalid_line(const InputChunk& chunk, const char* begin, const char* end)
+{
+	return "Invalid prefix on " + describe_line(chunk, begin, end);
+}
+
+template<typename T>
+bool parse_length(const char* begin, const char* end, short& length)
+{
+	// Prefix lengths are short, so anything longer than three digits is invalid
+	if (begin == end || end - begin > 3)
+		return false;
+
+	length = 0;
+	for (auto iter = begin; iter != end; ++iter)
+	{
+		if (*iter < '0' || *iter > '9')
+			return false;
+		length = length * 10 + (*iter - '0');
+	}
+
+	return length <= T::bit_length;
+}
+
+template<typename T, typename Callback>
+LineStatus match_prefix(const char* begin, const char* end, const regex_namespace::regex& regexp,
+						regex_namespace::cmatch& what, const Callback& callback)
+{
+	// Matches a line against a regular expression that captures the address and
+	// the prefix length, and calls a callback for the prefix. Lines that do not
+	// match are ignored.
+
+	if (!regex_namespace::regex_match(begin, end, what, regexp) || what.size() < 2)
+		return line_ignored;
+
+	T address;
+	short length;
+
+	if (what[2].matched && T::try_parse(what[1].first, what[1].second, address) &&
+		parse_length<T>(what[2].first, what[2].second, length))
+	{
+		callback(IPNode<T>(address, length));
+		return line_valid;
+	}
+
+	return line_invalid;
+}
+
+template<typename T, typename Callback>
+size_t read_regexp(const InputChunk& chunk, const regex_namespace::regex& regexp,
+				 bool skip_invalid, const Callback& callback)
+{
+	// Reads a chunk line-by-line and calls a callback for every successfuly matched
+	// and parsed IP address. Lines that match but do not contain a valid prefix
+	// are either counted and skipped or reported as an error. Returns the number
+	// of skipped lines.
+
+	regex_namespace::cmatch what;
+	size_t skipped = 0;
+
+	for_each_line(chunk.begin, chunk.end,
+		[&](const char* begin, const char* end) {
+		if (match_prefix<T>(begin, end, regexp, what, callback) == line_invalid)
+		{
+			if (!skip_invalid)
+				throw std::runtime_error(invalid_line(chunk, begin, end));
+			skipped++;
+		}
+	});
+
+	return skipped;
+}
+
+// Character classes of the textual address representations, used by the
+// prefix scanner to find the extent of an address token.
+
+template<typename T>
+struct address_chars;
+
+template<>
+struct address_chars<IPAddress::IPv4>
+{
+	static bool contains(const char c)
+	{
+		return (c >= '0' && c <= '9') || c == '.';
+	}
+};
+
+template<>
+struct address_chars<IPAddress::IPv6>
+{
+	static bool contains(const char c)
+	{
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+			(c >= 'A' && c <= 'F') || c == ':' || c == '.';
+	}
+};
+
+template<typename T, typename Callback>
+LineStatus scan_prefix(const char* begin, const char* end, const Callback& callback)
+{
+	// Finds the first [Address]/[Prefix length] token in a line and calls a callback
+	// for it. Returns line_ignored if there is no such token, and line_invalid if
+	// a token is found but does not parse.
+
+	for (auto slash = static_cast<const char*>(memchr(begin, '/', end - begin)); slash != nullptr;
+		slash = static_cast<const char*>(memchr(slash + 1, '/', end - slash - 1)))
+	{
+		auto address_start = slash;
+		while (address_start != begin && address_chars<T>::contains(*(address_start - 1)))
+			--address_start;
+
+		auto length_end = slash + 1;
+		int length = 0;
+		while (length_end != end && *length_end >= '0' && *length_end <= '9' && length <= T::bit_length)
+			length = length * 10 + (*length_end++ - '0');
+
+		if (address_start == slash || length_end == slash + 1)
+			continue;
+
+		T address;
+		if (length > T::bit_length || !T::try_parse(address_start, slash, address))
+			return line_invalid;
+
+		callback(IPNode<T>(address, length));
+		return line_valid;
+	}
+
+	return line_ignored;
+}
+
+template<typename T, typename Callback>
+size_t read_scanner(const InputChunk& chunk, bool skip_invalid, const Callback& callback)
+{
+	// Reads a chunk line-by-line and calls a callback for the first address token
+	// on every line. This is the default input path, as it is several times faster
+	// than matching a regular expression against every line. The file is scanned
+	// in place, so no line is ever copied. Invalid tokens are handled as in
+	// read_regexp().
+
+	size_t skipped = 0;
+
+	for_each_line(chunk.begin, chunk.end,
+		[&](const char* begin, const char* end) {
+		if (scan_prefix<T>(begin, end, callback) == line_invalid)
+		{
+			if (!skip_invalid)
+				throw std::runtime_error(invalid_line(chunk, begin, end));
+			skipped++;
+		}
+	});
+
+	return skipped;
+}
+
+// Binary RIB dumps in the MRT format (RFC 6396). Only the TABLE_DUMP_V2
+// records that hold unicast RIB entries are read, including the ADD-PATH
+// subtypes (RFC 8050).
+
+namespace mrt
+{
+	const size_t header_length = 12;
+	const uint16_t table_dump_v2 = 13;
+
+	// A RIB record starts with a sequence number and the prefix length, and
+	// holds at least the entry count besides the prefix
+	const size_t prefix_offset = 5;
+	const size_t min_rib_length = 7;
+
+	inline uint16_t read16(const char* data)
+	{
+		return static_cast<uint16_t>((static_cast<uint8_t>(data[0]) << 8) | static_cast<uint8_t>(data[1]));
+	}
+
+	inline uint32_t read32(const char* data)
+	{
+		return (static_cast<uint32_t>(read16(data)) << 16) | read16(data + 2);
+	}
+}
+
+template<typename T>
+struct mrt_subtypes;
+
+template<>
+struct mrt_subtypes<IPAddress::IPv4>
+{
+	static bool rib_unicast(const uint16_t subtype)
+	{
+		return subtype == 2 || subtype == 8;
+	}
+};
+
+template<>
+struct mrt_subtypes<IPAddress::IPv6>
+{
+	static bool rib_unicast(const uint16_t subtype)
+	{
+		return subtype == 4 || subtype == 10;
+	}
+};
+
+// Text never contains NUL bytes, while the type of an MRT record is a 16-bit
+// big-endian number far below 256, so the two cannot be confused.
+inline bool is_mrt(const char* begin, const char* end)
+{
+	return end - begin >= static_cast<ptrdiff_t>(mrt::header_length) &&
+		mrt::read16(begin + 4) == mrt::table_dump_v2;
+}
+
+std::string invalid_record(const InputChunk& chunk, const char* record)
+{
+	size_t offset = chunk.origin_offset + (record - chunk.origin);
+	return "Invalid MRT record at byte " + std::to_string(static_cast<unsigned long long>(offset)) +
+		" of " + chunk.file_name;
+}
+
+template<typename T, typename Callback>
+size_t read_mrt(const InputChunk& chunk, bool skip_invalid, const Callback& callback)
+{
+	// Reads an MRT file record by record and calls a callback for the prefix of
+	// every RIB record of the address family, skipping its entries. Records of
+	// other types are ignored. Invalid records are handled as invalid lines in
+	// read_scanner(), and a truncated record ends the input.
+
+	size_t skipped = 0;
+
+	auto invalid = [&](const char* record) {
+		if (!skip_invalid)
+			throw std::runtime_error(invalid_record(chunk, record));
+		skipped++;
+	};
+
+	for (const char* record = chunk.begin; record != chunk.end; )
+	{
+		const char* body = record + mrt::header_length;
+		if (chunk.end - record < static_cast<ptrdiff_t>(mrt::header_length) ||
+			mrt::read32(record + 8) > static_cast<size_t>(chunk.end - body))
+		{
+			invalid(record);
+			break;
+		}
+
+		const uint32_t length = mrt::read32(record + 8);
+
+		if (mrt::read16(record + 4) == mrt::table_dump_v2 && mrt_subtypes<T>::rib_unicast(mrt::read16(record + 6)))
+		{
+			short prefix = length < mrt::min_rib_length ? -1 : static_cast<uint8_t>(body[mrt::prefix_offset - 1]);
+			size_t bytes = (prefix + 7) / 8;
+
+			if (prefix < 0 || prefix > T::bit_length || length < mrt::min_rib_length + bytes)
+				invalid(record);
+			else
+			{
+				// Only the leading bytes of the prefix are stored
+				uint8_t address[T::byte_length] = {};
+				memcpy(address, body + mrt::prefix_offset, bytes);
+				callback(IPNode<T>(T::from_bytes(address), prefix));
+			}
+		}
+
+		record = body + length;
+	}
+
+	return skipped;
+}
+
+// Snapshots of a set of prefixes, written by the compile operation. The
+// header holds the magic bytes, the format version, the address family (4
+// or 6), the length of a record and the number of records, all big-endian.
+// The records follow as IPInterval stores them (the first address of the
+// block in network order and the prefix length), sorted and disjoint.
+
+namespace snapshot
+{
+	const char magic[] = "\x89" "BGPSET\n";
+	const size_t magic_length = 8;
+	const uint16_t version = 1;
+	const size_t header_length = 20;
+}
+
+template<typename T>
+uint8_t address_family()
+{
+	return T::bit_length == 32 ? 4 : 6;
+}
+
+inline bool is_snapshot(const char* begin, const char* end)
+{
+	return end - begin >= static_cast<ptrdiff_t>(snapshot::magic_length) &&
+		memcmp(begin, snapshot::magic, snapshot::magic_length) == 0;
+}
+
+template<typename T>
+IntervalRange<T> check_snapshot(const std::string& file, const char* begin, const char* end)
+{
+	// Returns the records of a snapshot, which are used as they are where
+	// the snapshot was mapped or received, so loading it takes no parsing at
+	// all.
+	static_assert(sizeof(IPInterval<T>) == T::byte_length + 1, "IPInterval must not be padded");
+
+	size_t size = end - begin;
+	if (size < snapshot::header_length || mrt::read16(begin + snapshot::magic_length) != snapshot::version)
+		throw std::runtime_error(file + " is not a snapshot of a supported version");
+	if (static_cast<uint8_t>(begin[10]) != address_family<T>() ||
+		static_cast<uint8_t>(begin[11]) != sizeof(IPInterval<T>))
+		throw std::runtime_error(file + " is a snapshot of a different address family");
+
+	uint64_t count = (static_cast<uint64_t>(mrt::read32(begin + 12)) << 32) | mrt::read32(begin + 16);
+	if (count > (size - snapshot::header_length) / sizeof(IPInterval<T>) ||
+		size != snapshot::header_length + count * sizeof(IPInterval<T>))
+		throw std::runtime_error(file + " is not a valid snapshot");
+
+	const IPInterval<T>* records = reinterpret_cast<const IPInterval<T>*>(begin + snapshot::header_length);
+	IntervalRange<T> intervals(records, records + count);
+
+	// Prefix lengths and host bits are checked as the other readers check
+	// them, since everything else relies on them being valid. The records
+	// are swept without being sorted, so they must be in order as well.
+	for (size_t i = 0; i < intervals.size(); i++)
+	{
+		T start = intervals[i].start();
+		if (intervals[i].prefix() > T::bit_length || start != start.network_zeros(intervals[i].prefix()) ||
+			(i != 0 && !(intervals[i - 1].last() < start)))
+			throw std::runtime_error(file + " is not a valid snapshot");
+	}
+
+	return intervals;
+}
+
+template<typename T>
+void write_snapshot(const IntervalRange<T>& intervals, OutputBuffer& output)
+{
+	uint64_t count = intervals.size();
+	char header[snapshot::header_length];
+
+	memcpy(header, snapshot::magic, snapshot::magic_length);
+	header[8] = static_cast<char>(snapshot::version >> 8);
+	header[9] = static_cast<char>(snapshot::version & 0xff);
+	header[10] = static_cast<char>(address_family<T>());
+	header[11] = static_cast<char>(sizeof(IPInterval<T>));
+	for (int i = 0; i < 8; i++)
+		header[12 + i] = static_cast<char>(count >> (56 - i * 8));
+
+	output.write(header, sizeof(header));
+	if (count != 0)
+		output.write(reinterpret_cast<const char*>(intervals.begin()), intervals.size() * sizeof(IPInterval<T>));
+}
+
+template<typename T, typename Adapter>
+void add(T start, T stop, const Adapter& callback)
+{
+	// Collapses an IP range into a collection of subnets with
+	// lowest prefix lengths. Each subnet is the largest block that is both
+	// aligned at the current start and fits into the rest of the range.
+
+	if (stop < start)
+		return;
+
+	for (;;)
+	{
+		short prefix = start.largest_block(stop);
+		callback(IPNode<T>(start, prefix));
+
+		// This also stops at the top of the IP address space
+		T last = start.network_ones(prefix);
+		if (last == stop) return;
+
+		start = last.next();
+	}
+}
+
+// Description of the algorithm:
+// http://stackoverflow.com/questions/11891109/algorithm-to-produce-a-difference-of-two-collections-of-intervals
+
+template<typename T, typename Adapter>
+struct batch_data
+{
+	int count;
+	bool inside;
+	T start;
+	const Adapter& callback;
+
+	// Set if the sweep starts in the middle of the markers (see traverse_parallel)
+	// inside a range whose start is unknown. When such a range ends, the callback
+	// is invoked with a node that has a prefix of -1 and the last address of
+	// the range, instead of the range being added.
+	bool continued;
+
+	batch_data(const Adapter& callback_) 
+		: count(0), inside(false), callback(callback_), continued(false) {};
+};
+
+template<typename T, typename Kernel, typename AdapterA, typename AdapterB>
+void track(const Kernel& kernel, const T& ip, const bool open,
+	batch_data<T, AdapterA>& A_, const batch_data<T, AdapterB>& B_)
+{
+	// Evaluates the kernel after all the markers of one kind (block starts or
+	// block ends) at an address have been counted.
+
+	if (kernel(A_.count, B_.count))
+	{
+		if (!A_.inside)
+		{
+			A_.inside = true;
+			if (open) A_.start = ip;
+			else      A_.start = ip.next();
+		}
+	}
+	else
+	{
+		if (A_.inside)
+		{
+			A_.inside = false;
+			T stop = open ? ip.previous() : ip;
+			if (A_.continued)
+			{
+				A_.continued = false;
+				A_.callback(IPNode<T>(stop, -1));
+			}
+			else
+				add<T>(A_.start, stop, A_.callback);
+		}
+	} 
+}
+
+template<typename T, typename Source, typename Kernel, typename AdapterA, typename AdapterB>
+void sweep(Source source, const Kernel& kernel,
+	batch_data<T, AdapterA>& A, batch_data<T, AdapterB>& B)
+{
+	// Traverses the sorted markers provided by a source (see MarkerMerge),
+	// applies appropriate comparison kernel and invokes appropriate callbacks.
+
+	IPMarker<T> marker, following;
+	bool more = source.next(following);
+
+	while (more)
+	{
+		marker = following;
+		more = source.next(following);
+
+		if (marker.type == ipm_a_open) A.count ++;
+		if (marker.type == ipm_a_close)  A.count --;
+		if (marker.type == ipm_b_open)  B.count ++;
+		if (marker.type == ipm_b_close)  B.count --;
+
+		bool open = is_open(marker.type);
+
+		// We would like to skip duplicate block starts and ends (while
+		// still counting them above, of course). A block that starts and
+		// ends at the same address (a /32 or a /128) is evaluated twice.
+
+		if (more && following.ip == marker.ip && is_open(following.type) == open)
+			continue;
+
+		track(kernel, marker.ip, open, A, B);
+
+		// If a comparison kernel is commutative, we don't have to track both.
+
+		if (!B.callback.empty())
+			track(kernel, marker.ip, open, B, A);
+	}
+}
+
+template<typename T, typename Source, typename Kernel, typename AdapterA, 
+	typename AdapterB = EmptyOutputAdapter<T>>
+void traverse( 
+	Source source,
+	const Kernel& kernel,
+	const AdapterA& callback_a,
+	const AdapterB& callback_b = AdapterB())
+{
+	batch_data<T, AdapterA> A(callback_a);
+	batch_data<T, AdapterB> B(callback_b);
+	sweep<T>(source, kernel, A, B);
+}
+
+template<typename T>
+class InsertAdapter : public OutputAdapter<T>
+{
+private:
+	// Writes into preallocated storage, advancing the pointer
+	IPInterval<T>*& next_;
+public:
+	InsertAdapter(IPInterval<T>*& next) : next_(next) {};
+
+	void operator ()(const IPNode<T>& node) const
+	{
+		*next_++ = IPInterval<T>(node.ip.network_zeros(node.prefix), node.prefix);
+	}
+};
+
+// Sorted intervals in memory. Sources of intervals provide peek(), which
+// returns the next interval or nullptr at the end, and pop().
+
+template<typename T>
+class IntervalArray
+{
+private:
+	const IPInterval<T>* next_;
+	const IPInterval<T>* end_;
+public:
+	IntervalArray(const IPInterval<T>* begin, const IPInterval<T>* end) :
+		next_(begin), end_(end) {};
+
+	const IPInterval<T>* peek() const { return next_ == end_ ? nullptr : next_; }
+	void pop() { ++next_; }
+};
+
+// Thrown by IntervalStream when an input turns out not to be sorted
+class unsorted_input : public std::runtime_error
+{
+public:
+	unsorted_input(const std::string& message) : std::runtime_error(message) {};
+};
+
+// Intervals read from a sorted file one line at a time, as they are needed,
+// so that the file can be swept without being loaded first. Invalid lines
+// are handled as in read_scanner() and read_regexp().
+
+template<typename T>
+class IntervalStream
+{
+private:
+	InputChunk input_;
+	const regex_namespace::regex* regexp_;
+	regex_namespace::cmatch what_;
+	bool skip_invalid_;
+	size_t& skipped_;
+	const char* position_;
+	IPInterval<T> current_;
+	bool more_;
+
+	void read()
+	{
+		const IPInterval<T> previous = current_;
+		const bool first = !more_;
+		more_ = false;
+
+		while (!more_ && position_ != input_.end)
+		{
+			const char* begin = position_;
+			const char* end = static_cast<const char*>(memchr(begin, '\n', input_.end - begin));
+			if (end == nullptr)
+				end = input_.end;
+			position_ = end == input_.end ? end : end + 1;
+
+			auto store = [&](const IPNode<T>& node) {
+				current_ = IPInterval<T>(node.ip.network_zeros(node.prefix), node.prefix);
+				more_ = true;
+			};
+
+			LineStatus status = regexp_ == nullptr ? scan_prefix<T>(begin, end, store) :
+				match_prefix<T>(begin, end, *regexp_, what_, store);
+
+			if (status == line_invalid)
+			{
+				if (!skip_invalid_)
+					throw std::runtime_error(invalid_line(input_, begin, end));
+				skipped_++;
+			}
+			else if (more_ && !first && current_ < previous)
+				throw unsorted_input("Unsorted input on " + describe_line(input_, begin, end));
+		}
+	}
+public:
+	// A null regexp selects the prefix scanner
+	IntervalStream(const InputChunk& input, const regex_namespace::regex* regexp,
+		bool skip_invalid, size_t& skipped) :
+		input_(input), regexp_(regexp), skip_invalid_(skip_invalid), skipped_(skipped),
+		position_(input.begin), more_(false)
+	{
+		read();
+	}
+
+	const IPInterval<T>* peek() const { return more_ ? &current_ : nullptr; }
+
+	void pop()
+	{
+		read();
+	}
+};
+
+// Yields the block start and end markers of a sorted source of intervals in
+// marker order. Blocks of prefixes are either nested or disjoint, so the last
+// addresses of the blocks that are open at any point form a stack with the
+// nearest one on top, and an end is due as soon as it is lower than the start
+// of the next interval.
+
+template<typename T, typename Intervals = IntervalArray<T>>
+class IntervalMarkers
+{
+private:
+	Intervals intervals_;
+	std::vector<T> open_;
+	IPMarkerType open_type_;
+	IPMarkerType close_type_;
+
+	// Block ends at or after limit_ are left to the following slice
+	// (see traverse_parallel)
+	bool limited_;
+	T limit_;
+public:
+	IntervalMarkers(const Intervals& intervals,
+		IPMarkerType open_type, IPMarkerType close_type) :
+		intervals_(intervals), open_type_(open_type), close_type_(close_type),
+		limited_(false) {};
+
+	// Starts in the middle of the address space with blocks that began
+	// earlier still open, eg. at the start of a slice
+	void open(const T& last)
+	{
+		open_.push_back(last);
+	}
+
+	void limit(const T& limit)
+	{
+		limited_ = true;
+		limit_ = limit;
+	}
+
+	int count() const { return static_cast<int>(open_.size()); }
+
+	// Returns false when there are no more markers
+	bool next(IPMarker<T>& marker)
+	{
+		const IPInterval<T>* following = intervals_.peek();
+
+		if (!open_.empty() && (following == nullptr || open_.back() < following->start()))
+		{
+			if (limited_ && !(open_.back() < limit_))
+				return false;
+			marker = IPMarker<T>(open_.back(), close_type_);
+			open_.pop_back();
+			return true;
+		}
+
+		if (following == nullptr)
+			return false;
+
+		T start = following->start();
+		marker = IPMarker<T>(start, open_type_);
+		open_.push_back(start.network_ones(following->prefix()));
+		intervals_.pop();
+		return true;
+	}
+};
+
+// Streaming two-way merge of the markers of both inputs. Yields them in
+// sorted order without materialising the merged sequence.
+
+template<typename T, typename Markers = IntervalMarkers<T>>
+class MarkerMerge
+{
+private:
+	Markers a_;
+	Markers b_;
+	IPMarker<T> a_next_;
+	IPMarker<T> b_next_;
+	bool a_more_;
+	bool b_more_;
+public:
+	MarkerMerge(const Markers& a, const Markers& b) :
+		a_(a), b_(b)
+	{
+		a_more_ = a_.next(a_next_);
+		b_more_ = b_.next(b_next_);
+	}
+
+	MarkerMerge(const IntervalRange<T>& a, const IntervalRange<T>& b) :
+		a_(IntervalArray<T>(a.begin(), a.end()), ipm_a_open, ipm_a_close),
+		b_(IntervalArray<T>(b.begin(), b.end()), ipm_b_open, ipm_b_close)
+	{
+		a_more_ = a_.next(a_next_);
+		b_more_ = b_.next(b_next_);
+	}
+
+	// Returns false when both inputs are exhausted
+	bool next(IPMarker<T>& marker)
+	{
+		if (a_more_ && (!b_more_ || !(b_next_ < a_next_)))
+		{
+			marker = a_next_;
+			a_more_ = a_.next(a_next_);
+			return true;
+		}
+
+		if (b_more_)
+		{
+			marker = b_next_;
+			b_more_ = b_.next(b_next_);
+			return true;
+		}
+
+		return false;
+	}
+};
+
+// Collects the output of a sweep over a slice of the markers, so that the
+// outputs of all slices can be passed on in order once they are finished.
+
+template<typename T>
+class RecordingAdapter : public OutputAdapter<T>
+{
+private:
+	std::vector<std::pair<bool, IPNode<T>>>& nodes_;
+	bool side_;
+	bool empty_;
+public:
+	RecordingAdapter(std::vector<std::pair<bool, IPNode<T>>>& nodes, bool side, bool empty) : 
+		nodes_(nodes), side_(side), empty_(empty) {};
+
+	void operator ()(const IPNode<T>& node) const 
+	{
+		nodes_.push_back(std::make_pair(side_, node));
+	}
+	bool empty() const { return empty_; };
+};
+
+template<typename T, typename Adapter>
+void replay(const IPNode<T>& node, const T& pending, const Adapter& callback)
+{
+	if (node.prefix == -1)
+		add<T>(pending, node.ip, callback);
+	else
+		callback(node);
+}
+
+template<typename T>
+IntervalMarkers<T> slice_markers(const IntervalRange<T>& intervals,
+	size_t begin, size_t end, const T* split, const T* next_split,
+	IPMarkerType open_type, IPMarkerType close_type)
+{
+	// Markers of the intervals that start in [split, next_split). Blocks that
+	// contain split but start before it are open at the start of the slice.
+	// They can only be the block of each prefix length that contains split,
+	// so they are found with one binary search per prefix length.
+
+	IntervalMarkers<T> markers(IntervalArray<T>(intervals.begin() + begin, intervals.begin() + end),
+		open_type, close_type);
+
+	if (split != nullptr)
+	{
+		for (short prefix = 0; prefix <= T::bit_length; prefix++)
+		{
+			T block = split->network_zeros(prefix);
+			if (!(block < *split))
+				break;
+
+			auto range = std::equal_range(intervals.begin(), intervals.begin() + begin,
+				IPInterval<T>(block, prefix));
+			for (auto iter = range.first; iter != range.second; ++iter)
+				markers.open(iter->last());
+		}
+	}
+
+	if (next_split != nullptr)
+		markers.limit(*next_split);
+
+	return markers;
+}
+
+template<typename T, typename Kernel, typename AdapterA, typename AdapterB = EmptyOutputAdapter<T>>
+void traverse_parallel(
+	const IntervalRange<T>& a,
+	const IntervalRange<T>& b,
+	unsigned threads,
+	const Kernel& kernel,
+	const AdapterA& callback_a,
+	const AdapterB& callback_b = AdapterB())
+{
+	// Splits the address space into slices with roughly the same number of
+	// intervals and sweeps each slice on its own thread. Blocks that are open
+	// at the start of a slice are looked up directly (see slice_markers).
+
+	auto before = [](const IPInterval<T>& interval, const T& ip) { return interval.start() < ip; };
+	const IntervalRange<T>& larger = a.size() >= b.size() ? a : b;
+
+	std::vector<size_t> a_bounds(1, 0), b_bounds(1, 0);
+	std::vector<T> splits;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		// Slices are split at an address, so markers at the same address
+		// never end up in different slices.
+		T split = larger[i * larger.size() / threads].start();
+		size_t a_bound = std::lower_bound(a.begin(), a.end(), split, before) - a.begin();
+		size_t b_bound = std::lower_bound(b.begin(), b.end(), split, before) - b.begin();
+
+		if (a_bound + b_bound > a_bounds.back() + b_bounds.back())
+		{
+			a_bounds.push_back(a_bound);
+			b_bounds.push_back(b_bound);
+			splits.push_back(split);
+		}
+	}
+	a_bounds.push_back(a.size());
+	b_bounds.push_back(b.size());
+
+	size_t slices = a_bounds.size() - 1;
+
+	struct slice_data
+	{
+		std::vector<std::pair<bool, IPNode<T>>> nodes;
+		bool inside[2];
+		bool continued[2];
+		T start[2];
+	};
+	std::vector<slice_data> results(slices);
+
+	parallel_for(slices, [&](size_t i) {
+		RecordingAdapter<T> record_a(results[i].nodes, false, callback_a.empty());
+		RecordingAdapter<T> record_b(results[i].nodes, true, callback_b.empty());
+		batch_data<T, RecordingAdapter<T>> A(record_a), B(record_b);
+
+		const T* split = i == 0 ? nullptr : &splits[i - 1];
+		const T* next_split = i + 1 == slices ? nullptr : &splits[i];
+		IntervalMarkers<T> markers_a = slice_markers(a, a_bounds[i], a_bounds[i + 1],
+			split, next_split, ipm_a_open, ipm_a_close);
+		IntervalMarkers<T> markers_b = slice_markers(b, b_bounds[i], b_bounds[i + 1],
+			split, next_split, ipm_b_open, ipm_b_close);
+
+		A.count = markers_a.count();
+		B.count = markers_b.count();
+		A.inside = A.continued = kernel(A.count, B.count);
+		B.inside = B.continued = kernel(B.count, A.count);
+
+		sweep<T>(MarkerMerge<T>(markers_a, markers_b), kernel, A, B);
+
+		results[i].inside[0] = A.inside; results[i].continued[0] = A.continued; results[i].start[0] = A.start;
+		results[i].inside[1] = B.inside; results[i].continued[1] = B.continued; results[i].start[1] = B.start;
+	});
+
+	// A range that is still open at the end of a slice is closed in one of the
+	// following ones.
+	T pending[2];
+	for (size_t i = 0; i < slices; i++)
+	{
+		for (auto& node : results[i].nodes)
+		{
+			if (node.first)
+				replay(node.second, pending[1], callback_b);
+			else
+				replay(node.second, pending[0], callback_a);
+		}
+
+		for (int side = 0; side < 2; side++)
+			if (results[i].inside[side] && !results[i].continued[side])
+				pending[side] = results[i].start[side];
+	}
+}
+
+std::string format_mask(const std::vector<uint64_t>& mask, size_t sources)
+{
+	// One hexadecimal digit per four sources, the first source being the
+	// lowest bit
+	static const char digits[] = "0123456789abcdef";
+	std::string text((sources + 3) / 4, '0');
+
+	for (size_t i = 0; i < text.size(); i++)
+		text[text.size() - 1 - i] = digits[(mask[i / 16] >> (i % 16 * 4)) & 0xf];
+
+	return text;
+}
+
+template<typename T, typename Kernel>
+void traverse_sources(std::vector<IntervalMarkers<T>>& sources, const Kernel& kernel, 
+	OutputBuffer& output)
+{
+	// Sweeps the markers of any number of sources at once, in the same way as
+	// sweep() does for two. Markers are merged through a heap that holds the
+	// next marker of every source. Ranges accepted by the kernel are output
+	// together with the bitmask of the sources that cover them, so a range
+	// also ends wherever the set of sources covering it changes.
+
+	typedef std::pair<IPMarker<T>, size_t> SourceMarker;
+	auto later = [](const SourceMarker& a, const SourceMarker& b) { return b.first < a.first; };
+	std::priority_queue<SourceMarker, std::vector<SourceMarker>, decltype(later)> markers(later);
+
+	IPMarker<T> marker;
+	for (size_t i = 0; i < sources.size(); i++)
+		if (sources[i].next(marker))
+			markers.push(std::make_pair(marker, i));
 
-	IPMarker(T ip_, IPMarkerType type_) :
-		ip(ip_), type(type_) {};
+	SourceCounts state(sources.size());
+	bool inside = false;
+	T start;
+	std::vector<uint64_t> start_mask;
+	std::string annotation;
 
-	bool operator < (const IPMarker& a) const 
+	while (!markers.empty())
 	{
-		return ip < a.ip;
-	}
-};
+		SourceMarker current = markers.top();
+		markers.pop();
+		if (sources[current.second].next(marker))
+			markers.push(std::make_pair(marker, current.second));
 
-// OutputAdapter base class. Provides a callback function for `IPNode`s
+		const T& ip = current.first.ip;
+		bool open = is_open(current.first.type);
+		state.update(current.second, open ? 1 : -1);
 
-template<typename T>
-class OutputAdapter
-{
-public:
-	virtual void operator ()(const IPNode<T>& node) const = 0;
-	virtual bool empty() const { return false; };
-};
+		// As in sweep(), the kernel is only evaluated once all the block starts
+		// or block ends at an address have been counted.
+		if (!markers.empty() && markers.top().first.ip == ip && is_open(markers.top().first.type) == open)
+			continue;
+
+		bool accepted = kernel(state);
+
+		if (inside && (!accepted || state.mask != start_mask))
+		{
+			inside = false;
+			annotation = format_mask(start_mask, sources.size());
+			add<T>(start, open ? ip.previous() : ip, AnnotatedAdapter<T>(output, annotation));
+		}
+
+		if (accepted && !inside)
+		{
+			inside = true;
+			start = open ? ip : ip.next();
+			start_mask = state.mask;
+		}
+	}
+}
 
 template<typename T>
-class EmptyOutputAdapter : public OutputAdapter<T>
+void sort_intervals(IntervalVector<T>& intervals)
 {
-public:
-	virtual void operator ()(const IPNode<T>& node) const {};
-	virtual bool empty() const { return true; };
-};
+	// Router exports are often sorted already, in which case the check is all
+	// we pay for.
+	if (!std::is_sorted(intervals.begin(), intervals.end()))
+		radix_sort(intervals.data(), intervals.data() + intervals.size());
+}
 
-template<typename T>
-class SimpleAdapter : public OutputAdapter<T>
+template<typename T, typename Adapter>
+void aggregate_intervals(const IPInterval<T>* begin, const IPInterval<T>* end, const Adapter& callback)
 {
-	virtual void operator ()(const IPNode<T>& node) const 
+	// Outputs the fewest disjoint prefixes that cover the same addresses as
+	// the sorted intervals, in order and in one pass. Intervals that overlap
+	// or adjoin the range built so far extend it, and any other closes it.
+	// A range never takes more prefixes than the intervals it was built
+	// from, so the output may overwrite the intervals already read.
+
+	if (begin == end)
+		return;
+
+	T start = begin->start();
+	T last = begin->last();
+
+	for (++begin; begin != end; ++begin)
 	{
-		std::cout << node.ip.to_string() << "/" << node.prefix << std::endl;
+		T following = begin->start();
+		T following_last = begin->last();
+
+		// The address after the top of the address space wraps around to
+		// zero, which cannot follow, but then every interval overlaps.
+		if (!(last < following) || following == last.next())
+		{
+			if (last < following_last)
+				last = following_last;
+		}
+		else
+		{
+			add<T>(start, last, callback);
+			start = following;
+			last = following_last;
+		}
 	}
-};
+
+	add<T>(start, last, callback);
+}
 
 template<typename T>
-class DiffAdapter : public OutputAdapter<T>
+void coalesce_intervals(IntervalVector<T>& intervals)
 {
-private:
-	std::string prefix_;
-public:
-	DiffAdapter(const std::string& prefix) : prefix_(prefix) {};
+	// Replaces sorted intervals with the fewest disjoint prefixes that cover
+	// the same addresses, in place
+	IPInterval<T>* next = intervals.data();
+	aggregate_intervals<T>(intervals.data(), intervals.data() + intervals.size(), InsertAdapter<T>(next));
+	intervals.resize(next - intervals.data());
+}
 
-	virtual void operator ()(const IPNode<T>& node) const 
-	{
-		std::cout << prefix_ << node.ip.to_string() << "/" << node.prefix << std::endl;
-	}
-};
+// Below this number of intervals, splitting the traversal between threads
+// costs more than it saves.
+const size_t parallel_threshold = 1 << 15;
 
-// ComparisonKernel base class. Provides a means to perform different operations on sets.
+// Inputs are only split between threads in chunks of at least this many bytes
+const size_t parallel_chunk_size = 1 << 20;
 
-class ComparisonKernel
+// Command line settings that control how the inputs are read and processed
+struct Options
 {
-public:
-	virtual bool operator ()(const int A, const int B) const = 0;
-	virtual bool symetric() const = 0;
+	std::string regex;
+	unsigned threads;
+	bool skip_invalid;
+	bool streaming;
+	bool exact;
+	bool coalesce;
+
+	Options() :
+		threads(default_threads()), skip_invalid(false), streaming(false), exact(false),
+		coalesce(false) {};
 };
 
-class UnionKernel : public ComparisonKernel
+void report_skipped(const std::string& file, size_t skipped, const std::string& unit = "line(s)")
 {
-	virtual bool operator ()(const int A, const int B) const 
-	{
-		return A > 0 || B > 0;
-	}
-	virtual bool symetric() const { return true; }
-};
+	// Written in one piece, as both inputs may be read at the same time
+	if (skipped != 0)
+		std::cerr << "Skipped " + std::to_string(static_cast<unsigned long long>(skipped)) +
+			" invalid " + unit + " in " + file + "\n" << std::flush;
+}
 
-class IntersectionKernel : public ComparisonKernel
+inline const char* complete_lines(const char* begin, const char* end)
 {
-	virtual bool operator ()(const int A, const int B) const 
-	{
-		return A > 0 && B > 0;
-	}
-	virtual bool symetric() const { return true; }
-};
+	// End of the last whole line in [begin, end)
+	while (end != begin && *(end - 1) != '\n')
+		--end;
+	return end;
+}
+
+inline const char* complete_records(const char* begin, const char* end)
+{
+	// End of the last whole MRT record in [begin, end)
+	while (static_cast<size_t>(end - begin) >= mrt::header_length &&
+		mrt::read32(begin + 8) <= static_cast<size_t>(end - begin) - mrt::header_length)
+		begin += mrt::header_length + mrt::read32(begin + 8);
+	return begin;
+}
+
+// Intervals of one input. They are read into storage of their own, except
+// for the records of a snapshot file, which are swept where the file is
+// mapped, so the mapping is kept along with them.
 
-class DifferenceKernel : public ComparisonKernel
+template<typename T>
+struct LoadedInput
 {
-	virtual bool operator ()(const int A, const int B) const 
+	IntervalVector<T> intervals;
+	std::unique_ptr<MappedFile> snapshot;
+	IntervalRange<T> records;
+
+	// Set once the intervals are sorted and merged into the fewest disjoint
+	// subnets, as they are in snapshots
+	bool coalesced;
+
+	LoadedInput() : coalesced(false) {};
+
+	IntervalRange<T> range() const
 	{
-		return A == 0 && B > 0;
+		return snapshot ? records : IntervalRange<T>(intervals);
 	}
-	virtual bool symetric() const { return false; }
 };
 
 template<typename T>
-void read_regexp(const std::string& in_file, const regex_namespace::regex& regexp,
-				 const OutputAdapter<T>& callback)
+void read_stream(const std::string& file, const BlockSource& source, const Options& options,
+				 LoadedInput<T>& loaded)
 {
-	// Reads a file line-by-line and calls a callback for every successfuly matched
-	// and parsed IP address.
+	// Input that arrives in blocks (see InputStream) is parsed as it arrives.
+	// The whole lines or MRT records of every block are read, and the rest
+	// is carried over to the next block.
 
-	regex_namespace::smatch what;
-	std::ifstream file_to_read(in_file);
+	regex_namespace::regex regexp;
+	if (!options.regex.empty())
+		regexp = regex_namespace::regex(options.regex.c_str());
 
-	if (!file_to_read)
-		throw std::runtime_error("Cannot read file!");
+	std::vector<char> pending;
+	size_t count = 0, skipped = 0, offset = 0, lines = 0;
+	bool detected = false, binary = false, compiled = false, more = true;
 
-	while (!file_to_read.eof())
+	while (more)
 	{
-		std::string hay;
-		getline(file_to_read, hay);
+		const char *block_begin, *block_end;
+		more = source(block_begin, block_end);
+		if (more)
+			pending.insert(pending.end(), block_begin, block_end);
+
+		// The format is known once the header of the first record has arrived
+		if (!detected)
+		{
+			if (more && pending.size() < mrt::header_length)
+				continue;
+			binary = is_mrt(pending.data(), pending.data() + pending.size());
+			compiled = is_snapshot(pending.data(), pending.data() + pending.size());
+			detected = true;
+		}
 
-		if (regex_namespace::regex_match(hay, what, regexp))
-		{		
-			if (what.size() >= 2)
+		// Snapshots are copied in one piece once they have arrived
+		if (compiled)
+		{
+			if (!more)
 			{
-				IPNode<T> new_node(T(what[1].str()), atoi(what[2].str().c_str()));
-				callback(new_node);
+				IntervalRange<T> records = check_snapshot<T>(file, pending.data(), pending.data() + pending.size());
+				loaded.intervals.assign(records.begin(), records.end());
+				loaded.coalesced = true;
 			}
+			continue;
 		}
-	} 
+
+		IntervalVector<T>& intervals = loaded.intervals;
+
+		const char* begin = pending.data();
+		const char* end = begin + pending.size();
+		if (more)
+			end = binary ? complete_records(begin, end) : complete_lines(begin, end);
+
+		// Storage is bounded as in read_input()
+		size_t newlines = binary ? 0 : std::count(begin, end, '\n');
+		size_t bound = binary ? (end - begin) / (mrt::header_length + mrt::min_rib_length) + 1 :
+			newlines + 1;
+		intervals.resize(count + bound);
+		IPInterval<T>* next = intervals.data() + count;
+		InsertAdapter<T> insert(next);
+
+		InputChunk chunk = { file, begin, begin, end, offset, lines };
+		if (binary)
+			skipped += read_mrt<T>(chunk, options.skip_invalid, insert);
+		else if (options.regex.empty())
+			skipped += read_scanner<T>(chunk, options.skip_invalid, insert);
+		else
+			skipped += read_regexp<T>(chunk, regexp, options.skip_invalid, insert);
+		count = next - intervals.data();
+
+		lines += newlines;
+		offset += end - begin;
+		pending.erase(pending.begin(), pending.begin() + (end - begin));
+	}
+
+	if (compiled)
+		return;
+
+	loaded.intervals.resize(count);
+	report_skipped(file, skipped, binary ? "record(s)" : "line(s)");
 }
 
 template<typename T>
-void add(T start, T stop, const OutputAdapter<T>& callback)
+void read_pipe(const std::string& file, const Options& options, LoadedInput<T>& loaded)
 {
-	// Collapses an IP range into a collection of subnets with
-	// lowest prefix lengths.
+	// Standard input ("-") and pipes are read on a separate thread while the
+	// data that has already arrived is parsed, so that parsing overlaps with
+	// the program that writes them. Compressed data is recognised by its
+	// first bytes and decompressed on yet another thread.
 
-	while (start < stop)
-	{
-		for (int i=0; i <= T::bit_length; i++)
-		{
-			if (start.network_zeros(i) == start && 
-				start.network_ones(i) <= stop)
-			{
-				callback(IPNode<T>(start,i));
+	InputFile input(file);
+	FileReader reader(input.get());
+	InputStream raw([&](char* buffer, size_t size) { return reader.read(buffer, size); },
+		[&] { reader.cancel(); });
 
-				// We have reached the top of the IP address space
-				if (start.network_ones(i) == start.network_ones()) return;
+	// A read returns whatever has arrived, which may be too little to tell
+	// the format, so blocks are collected until it is enough. They are
+	// copied, as a block is only valid until the next one is read.
+	std::vector<char> head;
+	const char *block_begin, *block_end;
+	while (head.size() < compression_magic_length && raw.next(block_begin, block_end))
+		head.insert(head.end(), block_begin, block_end);
 
-				start = start.network_ones(i).next();
-				break;
-			}
+	// The collected blocks are passed on before the rest
+	bool first = !head.empty();
+	BlockSource source = [&](const char*& begin, const char*& end) {
+		if (first)
+		{
+			first = false;
+			begin = head.data();
+			end = begin + head.size();
+			return true;
 		}
+		return raw.next(begin, end);
+	};
 
+	Compression compression = detect_compression(head.data(), head.data() + head.size());
+	if (compression != compression_none)
+	{
+		// The decompressor waits for the raw stream, which is stopped first
+		InputStream stream(decompressor(compression, source, file), [&] { raw.cancel(); });
+		read_stream<T>(file, [&](const char*& begin, const char*& end) { return stream.next(begin, end); },
+			options, loaded);
 	}
+	else
+		read_stream<T>(file, source, options, loaded);
 }
 
-// Description of the algorithm:
-// http://stackoverflow.com/questions/11891109/algorithm-to-produce-a-difference-of-two-collections-of-intervals
-
 template<typename T>
-void traverse( 
-	typename std::vector<IPMarker<T>>::iterator start, 
-	typename std::vector<IPMarker<T>>::iterator stop, 
-	const ComparisonKernel& kernel,
-	const OutputAdapter<T>& callback_a,
-	const OutputAdapter<T>& callback_b = EmptyOutputAdapter<T>())
-{ 			
-	// Traverses the marker vector, applies appropriate comparison kernel and
-	// invokes appropriate callbacks.
+void read_input(const std::string& file, const Options& options,
+				unsigned threads, LoadedInput<T>& loaded)
+{
+	// We read IPs either with the built-in prefix scanner or, if a custom regex
+	// was given, by matching a regexp. If a token is found but IP is invalid, it
+	// will throw an exception unless invalid lines are to be skipped.
+
+	if (is_stream(file))
+	{
+		read_pipe<T>(file, options, loaded);
+		return;
+	}
 
-	struct batch_data
+	std::unique_ptr<MappedFile> mapping(new MappedFile(file));
+	const MappedFile& input = *mapping;
+	IntervalVector<T>& intervals = loaded.intervals;
+
+	Compression compression = detect_compression(input.begin(), input.end());
+	if (compression != compression_none)
 	{
-		int count;
-		bool inside;
-		T start;
-		const OutputAdapter<T>& callback;
+		// Compressed files are decompressed on a separate thread, while the
+		// data that has already been decompressed is parsed
+		InputStream stream(decompressor(compression, memory_blocks(input.begin(), input.end()), file));
+		read_stream<T>(file, [&](const char*& begin, const char*& end) { return stream.next(begin, end); },
+			options, loaded);
+		return;
+	}
 
-		batch_data(const OutputAdapter<T>& callback_) 
-			: count(0), inside(false), callback(callback_) {};
-	} A(callback_a), B(callback_b);
+	if (is_snapshot(input.begin(), input.end()))
+	{
+		loaded.records = check_snapshot<T>(file, input.begin(), input.end());
+		loaded.snapshot = std::move(mapping);
+		loaded.coalesced = true;
+		return;
+	}
 
-	for(auto iter = start; iter != stop; ++iter)
+	if (is_mrt(input.begin(), input.end()))
 	{
-		if (iter->type == ipm_a_open) A.count ++; 
-		if (iter->type == ipm_a_close)  A.count --; 
-		if (iter->type == ipm_b_open)  B.count ++; 
-		if (iter->type == ipm_b_close)  B.count --;
+		// MRT files are read in one piece, straight into storage bounded by
+		// the size of the smallest RIB record
+		InputChunk chunk = { file, input.begin(), input.begin(), input.end(), 0, 0 };
+		intervals.resize(input.size() / (mrt::header_length + mrt::min_rib_length) + 1);
+		IPInterval<T>* next = intervals.data();
+		report_skipped(file, read_mrt<T>(chunk, options.skip_invalid, InsertAdapter<T>(next)), "record(s)");
+		intervals.resize(next - intervals.data());
+		return;
+	}
 
-		bool open = iter->type == ipm_a_open || iter->type == ipm_b_open;
+	regex_namespace::regex regexp;
+	if (!options.regex.empty())
+		regexp = regex_namespace::regex(options.regex.c_str());
 
-		// We would like to skip duplicate block starts (while 
-		// still counting them above, of course)
+	// Large files are split into chunks of whole lines, which are read on
+	// separate threads.
+	size_t chunks = std::max<size_t>(1,
+		std::min<size_t>(threads, input.size() / parallel_chunk_size));
+	std::vector<const char*> bounds = split_lines(input.begin(), input.end(), chunks);
+	chunks = bounds.size() - 1;
 
-		if (iter + 1 != stop)
-		{
-			if ((iter + 1)->ip == iter->ip)
-				continue;
-		}
+	// There is at most one prefix per line, so the number of lines in a
+	// chunk bounds the number of intervals read from it. The storage for all
+	// of them is allocated once and each chunk is read directly into its own
+	// region, which are then moved together in file order.
+	//
+	// A line holds at least an address, a prefix length and a newline (with
+	// a regular expression, the captures may share characters). As long as
+	// the storage for that many lines is no larger than the input, the size
+	// is used as the bound and capacity that is never written costs address
+	// space only (see PageAllocator). Otherwise, as for IPv6, where it could
+	// be several times larger than the memory of the machine, the lines are
+	// counted first.
+	const size_t min_line_length = T::min_string_length + (options.regex.empty() ? 3 : 1);
+	const bool count_lines = (input.size() / min_line_length + chunks) * sizeof(IPInterval<T>) > input.size();
+
+	std::vector<size_t> offsets(chunks + 1, 0), counts(chunks), skipped(chunks);
+	parallel_for(chunks, [&](size_t i) {
+		counts[i] = (count_lines ? std::count(bounds[i], bounds[i + 1], '\n') :
+			(bounds[i + 1] - bounds[i]) / min_line_length) + 1;
+	});
+	for (size_t i = 0; i < chunks; i++)
+		offsets[i + 1] = offsets[i] + counts[i];
+	intervals.resize(offsets[chunks]);
+
+	// If several chunks are invalid, the exception from the first one is
+	// rethrown, so the error is the same as when reading sequentially.
+	parallel_for(chunks, [&](size_t i) {
+		InputChunk chunk = { file, input.begin(), bounds[i], bounds[i + 1], 0, 0 };
+		IPInterval<T>* next = intervals.data() + offsets[i];
+		InsertAdapter<T> insert(next);
+
+		if (options.regex.empty())
+			skipped[i] = read_scanner<T>(chunk, options.skip_invalid, insert);
+		else
+			skipped[i] = read_regexp<T>(chunk, regexp, options.skip_invalid, insert);
+
+		counts[i] = next - (intervals.data() + offsets[i]);
+	});
+
+	size_t total = counts[0], total_skipped = skipped[0];
+	for (size_t i = 1; i < chunks; i++)
+	{
+		std::copy(intervals.begin() + offsets[i], intervals.begin() + offsets[i] + counts[i],
+			intervals.begin() + total);
+		total += counts[i];
+		total_skipped += skipped[i];
+	}
+	intervals.resize(total);
+
+	report_skipped(file, total_skipped);
+}
+
+template<typename T>
+void coalesce_input(LoadedInput<T>& loaded)
+{
+	// Coalescing needs the intervals in order, so it sorts them as well
+	if (loaded.coalesced)
+		return;
+	sort_intervals(loaded.intervals);
+	coalesce_intervals(loaded.intervals);
+	loaded.coalesced = true;
+}
+
+template<typename T>
+void prepare_intervals(LoadedInput<T>& loaded, const Options& options, bool sort)
+{
+	if (options.coalesce)
+		coalesce_input(loaded);
+	else if (sort && !loaded.coalesced)
+		sort_intervals(loaded.intervals);
+}
+
+template<typename T>
+void read_inputs(const std::string & file1,
+				 const std::string & file2,
+				 const Options& options,
+				 bool sort,
+				 LoadedInput<T>& intervals_a,
+				 LoadedInput<T>& intervals_b
+				 )
+{
+	// With several threads both inputs are loaded at the same time, and the
+	// threads are shared between them by size. Streams count as empty, as
+	// they are parsed by a single thread.
+
+	const unsigned threads = options.threads;
+
+	if (threads > 1)
+	{
+		size_t size_a = input_size(file1), size_b = input_size(file2);
+		size_t total = size_a + size_b;
+		unsigned threads_a = total == 0 ? 1 :
+			static_cast<unsigned>((static_cast<double>(threads) * size_a) / total + 0.5);
+		threads_a = std::min(std::max(threads_a, 1u), threads - 1);
 
-		auto track = [&](batch_data& A_, batch_data& B_) { 
-			if (kernel(A_.count, B_.count))
+		parallel_for(2, [&](size_t i) {
+			if (i == 0)
 			{
-				if (!A_.inside)
-				{
-					A_.inside = true;
-					if (open) A_.start = iter->ip;
-					else      A_.start = iter->ip.next();
-				}
+				read_input<T>(file1, options, threads_a, intervals_a);
+				prepare_intervals(intervals_a, options, sort);
 			}
 			else
 			{
-				if (A_.inside)
-				{
-					A_.inside = false;
-					if (open) add<T>(A_.start, iter->ip.previous(), A_.callback);
-					else      add<T>(A_.start, iter->ip,            A_.callback);
-				}
-			} 
-		};
+				read_input<T>(file2, options, threads - threads_a, intervals_b);
+				prepare_intervals(intervals_b, options, sort);
+			}
+		});
+	}
+	else
+	{
+		read_input<T>(file1, options, 1, intervals_a);
+		read_input<T>(file2, options, 1, intervals_b);
+		prepare_intervals(intervals_a, options, sort);
+		prepare_intervals(intervals_b, options, sort);
+	}
+}
+
+template<typename T, typename Kernel, typename AdapterA, typename AdapterB = EmptyOutputAdapter<T>>
+void compare_exact(
+	const IntervalRange<T>& a,
+	const IntervalRange<T>& b,
+	const Kernel& kernel,
+	const AdapterA& callback_a,
+	const AdapterB& callback_b = AdapterB())
+{
+	// Compares the prefixes themselves rather than the address space they
+	// cover. Every distinct prefix is evaluated once, with a count of one or
+	// zero for each input, in the order in which it first appears in A and
+	// then in B. Prefixes of B are inserted into the set of A once A has been
+	// evaluated, so that duplicates in B are only evaluated once as well.
 
-		track(A,B);
+	IntervalSet<T> set_a(a.size() + b.size()), set_b(b.size());
+	for (auto& interval : b)
+		set_b.insert(interval);
 
-		// If a comparison kernel is commutative, we don't have to track both.
+	auto evaluate = [&](const IPInterval<T>& interval, int A, int B) {
+		IPNode<T> node(interval.start(), interval.prefix());
+		if (kernel(A, B))
+			callback_a(node);
+		if (!callback_b.empty() && kernel(B, A))
+			callback_b(node);
+	};
 
-		if (!B.callback.empty())
-			track(B,A);
-	}
+	for (auto& interval : a)
+		if (set_a.insert(interval))
+			evaluate(interval, 1, set_b.contains(interval) ? 1 : 0);
+
+	for (auto& interval : b)
+		if (set_a.insert(interval))
+			evaluate(interval, 0, 1);
 }
 
-template<typename T>
-class InsertAdapter : public OutputAdapter<T>
+template<typename T, typename Kernel>
+void process_exact(const std::string & file1,
+				   const std::string & file2,
+				   const Options& options,
+				   const Kernel& kernel,
+				   OutputBuffer& output
+				   )
 {
-private:
-	std::vector<IPMarker<T>>& vector_;
-	IPMarkerType start_;
-	IPMarkerType stop_;
-public:
-	InsertAdapter(std::vector<IPMarker<T>>& vector, IPMarkerType start, 
-		IPMarkerType stop) : vector_(vector), start_(start), stop_(stop) {};
+	// Exact comparison needs neither sorted inputs nor a traversal
+	LoadedInput<T> intervals_a, intervals_b;
+	read_inputs<T>(file1, file2, options, false, intervals_a, intervals_b);
+
+	// Snapshots hold merged subnets, so the prefixes of the other input are
+	// merged in the same way (as with -c) before they are compared
+	if (intervals_a.coalesced)
+		coalesce_input(intervals_b);
+	if (intervals_b.coalesced)
+		coalesce_input(intervals_a);
+
+	if (kernel.symetric())
+		compare_exact<T>(intervals_a.range(), intervals_b.range(), kernel, SimpleAdapter<T>(output));
+	else
+		compare_exact<T>(intervals_a.range(), intervals_b.range(), kernel,
+			DiffAdapter<T>(output, "+"), DiffAdapter<T>(output, "-"));
+}
+
+template<typename T, typename Kernel>
+bool process_streaming(const std::string & file1,
+					   const std::string & file2,
+					   const Options& options,
+					   const Kernel& kernel,
+					   OutputBuffer& output
+					   )
+{
+	// Both inputs are read one line at a time and swept in lockstep, so memory
+	// use does not depend on their size. Throws unsorted_input if either of
+	// them turns out not to be sorted. MRT, snapshot and compressed inputs,
+	// and inputs that are not regular files, are not streamed, in which case
+	// nothing is done and false is returned.
+
+	if (is_stream(file1) || is_stream(file2))
+		return false;
+
+	MappedFile input_a(file1), input_b(file2);
+	if (is_mrt(input_a.begin(), input_a.end()) || is_mrt(input_b.begin(), input_b.end()) ||
+		is_snapshot(input_a.begin(), input_a.end()) || is_snapshot(input_b.begin(), input_b.end()) ||
+		detect_compression(input_a.begin(), input_a.end()) != compression_none ||
+		detect_compression(input_b.begin(), input_b.end()) != compression_none)
+		return false;
+	regex_namespace::regex regexp;
+	if (!options.regex.empty())
+		regexp = regex_namespace::regex(options.regex.c_str());
+	const regex_namespace::regex* pattern = options.regex.empty() ? nullptr : &regexp;
+
+	InputChunk chunk_a = { file1, input_a.begin(), input_a.begin(), input_a.end(), 0, 0 };
+	InputChunk chunk_b = { file2, input_b.begin(), input_b.begin(), input_b.end(), 0, 0 };
+	size_t skipped_a = 0, skipped_b = 0;
+
+	typedef IntervalMarkers<T, IntervalStream<T>> Markers;
+	MarkerMerge<T, Markers> markers(
+		Markers(IntervalStream<T>(chunk_a, pattern, options.skip_invalid, skipped_a), ipm_a_open, ipm_a_close),
+		Markers(IntervalStream<T>(chunk_b, pattern, options.skip_invalid, skipped_b), ipm_b_open, ipm_b_close));
 
-	virtual void operator ()(const IPNode<T>& node) const 
+	if (kernel.symetric())
+		traverse<T>(markers, kernel, SimpleAdapter<T>(output));
+	else
+		traverse<T>(markers, kernel, DiffAdapter<T>(output, "+"), DiffAdapter<T>(output, "-"));
+
+	report_skipped(file1, skipped_a);
+	report_skipped(file2, skipped_b);
+	return true;
+}
+
+template<typename T, typename Kernel>
+void process(const std::string & file1,
+			 const std::string & file2,
+			 const Options& options,
+			 const Kernel& kernel,
+			 OutputBuffer& output
+			 )
+{
+	if (options.exact)
 	{
-		vector_.push_back(IPMarker<T>(node.ip.network_zeros(node.prefix), start_));  
-		vector_.push_back(IPMarker<T>(node.ip.network_ones(node.prefix), stop_  ));
+		process_exact<T>(file1, file2, options, kernel, output);
+		return;
 	}
-};
+
+	if (options.streaming)
+	{
+		try
+		{
+			if (process_streaming<T>(file1, file2, options, kernel, output))
+				return;
+		}
+		catch (const unsorted_input& error)
+		{
+			// Unless some output has already been written, the inputs are simply
+			// read in full and sorted.
+			if (!output.discard())
+				throw std::runtime_error(std::string(error.what()) +
+					", after output has been written (run without -S)");
+			std::cerr << std::string(error.what()) + ", sorting the inputs instead\n" << std::flush;
+		}
+	}
+
+	LoadedInput<T> intervals_a, intervals_b;
+	const unsigned threads = options.threads;
+
+	// Each input is read and sorted on its own, and the two are merged on the
+	// fly during traversal.
+	read_inputs<T>(file1, file2, options, true, intervals_a, intervals_b);
+
+	// Deep magic begins here
+	IntervalRange<T> a = intervals_a.range(), b = intervals_b.range();
+	if (threads > 1 && a.size() + b.size() >= parallel_threshold)
+	{
+		if (kernel.symetric())
+			traverse_parallel<T>(a, b, threads, kernel, SimpleAdapter<T>(output));
+		else
+			traverse_parallel<T>(a, b, threads, kernel, 
+				DiffAdapter<T>(output, "+"), DiffAdapter<T>(output, "-"));
+	}
+	else
+	{
+		if (kernel.symetric())
+			traverse<T>(MarkerMerge<T>(a, b), kernel, SimpleAdapter<T>(output));
+		else
+			traverse<T>(MarkerMerge<T>(a, b), kernel, 
+				DiffAdapter<T>(output, "+"), DiffAdapter<T>(output, "-"));
+	}
+}
 
 template<typename T>
-void process(const std::string & file1, 
-			 const std::string & file2, 
-			 const std::string & regex,
-			 const ComparisonKernel& kernel
+void process(const std::string & kernel_type,
+			 const std::string & file1,
+			 const std::string & file2,
+			 const Options& options,
+			 OutputBuffer& output
 			 )
 {
-	std::vector<IPMarker<T>> markers;
+	// The kernel is selected once here, every instantiation of process() and
+	// everything below it is specialised for it.
+	if (kernel_type == "diff")
+		process<T>(file1, file2, options, DifferenceKernel(), output);
+	else if (kernel_type == "union")
+		process<T>(file1, file2, options, UnionKernel(), output);
+	else
+		process<T>(file1, file2, options, IntersectionKernel(), output);
+}
 
-	// We read IPs from both files by matching a regexp. If a regex matches
-	// but IP is invalid, it will throw an exception.
+template<typename T, typename Kernel>
+void process_sources(const std::vector<std::string>& files,
+					 const Options& options,
+					 const Kernel& kernel,
+					 OutputBuffer& output
+					 )
+{
+	// Every file is read and sorted on its own, by as many threads as allowed,
+	// each taking the next file that has not been loaded yet. All of them are
+	// then swept in one pass.
 
-	read_regexp<T>(file1, regex_namespace::regex(regex.c_str()), 
-		InsertAdapter<T>(markers, ipm_a_open, ipm_a_close));
-	read_regexp<T>(file2, regex_namespace::regex(regex.c_str()), 
-		InsertAdapter<T>(markers, ipm_b_open, ipm_b_close));
+	std::vector<LoadedInput<T>> intervals(files.size());
+	std::atomic<size_t> next_file(0);
 
-	std::sort(markers.begin(), markers.end());
+	parallel_for(std::min<size_t>(options.threads, files.size()), [&](size_t) {
+		for (size_t i = next_file++; i < files.size(); i = next_file++)
+		{
+			read_input<T>(files[i], options, 1, intervals[i]);
+			prepare_intervals(intervals[i], options, true);
+		}
+	});
 
-	// Deep magic begins here
-	if (kernel.symetric())
-		traverse<T>(markers.begin(), markers.end(), kernel, SimpleAdapter<T>());
+	// Sources are told apart by their index, so they all share marker types
+	std::vector<IntervalMarkers<T>> sources;
+	sources.reserve(files.size());
+	for (auto& source : intervals)
+		sources.push_back(IntervalMarkers<T>(
+			IntervalArray<T>(source.range().begin(), source.range().end()), ipm_a_open, ipm_a_close));
+
+	traverse_sources<T>(sources, kernel, output);
+}
+
+template<typename T>
+void process_sources(const std::string & kernel_type,
+					 size_t minimum,
+					 const std::vector<std::string>& files,
+					 const Options& options,
+					 OutputBuffer& output
+					 )
+{
+	if (kernel_type == "all")
+		process_sources<T>(files, options, AllKernel(), output);
+	else if (kernel_type == "atleast")
+		process_sources<T>(files, options, AtLeastKernel(minimum), output);
 	else
-		traverse<T>(markers.begin(), markers.end(), kernel, DiffAdapter<T>("+"), DiffAdapter<T>("-"));
+		process_sources<T>(files, options, MissingKernel(), output);
+}
+
+template<typename T>
+void compile(const std::string & file,
+			 const Options& options,
+			 OutputBuffer& output
+			 )
+{
+	LoadedInput<T> intervals;
+	read_input<T>(file, options, options.threads, intervals);
+	coalesce_input(intervals);
+	write_snapshot(intervals.range(), output);
+}
+
+template<typename T>
+void aggregate(const std::string & file,
+			   const Options& options,
+			   OutputBuffer& output
+			   )
+{
+	LoadedInput<T> intervals;
+	read_input<T>(file, options, options.threads, intervals);
+	prepare_intervals(intervals, options, true);
+	IntervalRange<T> range = intervals.range();
+	aggregate_intervals<T>(range.begin(), range.end(), SimpleAdapter<T>(output));
 }
 
 namespace default_regex
@@ -331,19 +2052,51 @@ void print_syntax()
 {
 	std::cout << 
 		"Usage: " <<std::endl <<
-		"    bgpcompare [diff|union|intersect] [ipv6|ipv4] fileA fileB [regex]" << std::endl <<
+		"    bgpcompare [options] [diff|union|intersect] [ipv6|ipv4] fileA fileB [regex]" << std::endl <<
+		"    bgpcompare [options] [all|atleast k|missing] [ipv6|ipv4] file1 file2 ..." << std::endl <<
+		"    bgpcompare [options] [compile|aggregate] [ipv6|ipv4] file" << std::endl <<
+		std::endl <<
+		"Options:" << std::endl <<
+		" -o file:   Write the output to a file instead of standard output." << std::endl <<
+		" -l:        Flush the output after every line (useful when piping the" << std::endl <<
+		"            output into an interactive program)." << std::endl <<
+		" -j n:      Use n threads (defaults to the number of processors)." << std::endl <<
+		" -s:        Skip lines with an invalid address or prefix length instead" << std::endl <<
+		"            of stopping, and report how many were skipped." << std::endl <<
+		" -S:        Stream inputs that are sorted by address instead of loading" << std::endl <<
+		"            them into memory. If an input turns out not to be sorted," << std::endl <<
+		"            it is sorted after all, unless output has been written." << std::endl <<
+		"            Only applies to operations on two files." << std::endl <<
+		" -x:        Compare prefixes exactly instead of the address space they" << std::endl <<
+		"            cover, so that a /24 differs from its two /25s. Prefixes are" << std::endl <<
+		"            output in the order of fileA and then fileB. Only applies to" << std::endl <<
+		"            operations on two files. A snapshot holds merged subnets," << std::endl <<
+		"            so the other file is merged the same way, as with -c." << std::endl <<
+		" -c:        Merge the subnets of every file into the fewest disjoint" << std::endl <<
+		"            subnets once it is loaded. Results cover the same addresses" << std::endl <<
+		"            (adjacent subnets may be output merged), and inputs with" << std::endl <<
+		"            many nested subnets are compared faster. With -x, the merged" << std::endl <<
+		"            subnets are compared and output in order." << std::endl <<
+		" -r regex:  Match the addresses using a regular expression (see below)." << std::endl <<
 		std::endl <<
 		"Input:" << std::endl <<
 		"The program will read IP addresses from files specified by fileA and " << std::endl <<
-		"fileB, one per line. IP addresses are matched using a regular expres-" << std::endl <<
-		"sion with two captures,  one for the address and the other for prefix" << std::endl <<
-		"length. If a regular expression does  not match, the line is ignored." << std::endl <<
-		"Full line must  be matched. By default, these two regular expressions" << std::endl <<
-		"are used: " << std::endl <<
+		"fileB, one per line. By default, every line is scanned for the first " << std::endl <<
+		"[Address]/[Prefix length] token and lines without one are ignored. " << std::endl <<
+		"Alternatively, IP addresses can be matched using a regular expression" << std::endl <<
+		"with two captures,  one for the address and the other for prefix len-" << std::endl <<
+		"gth, provided as a fifth command line parameter or with -r. If a re-" << std::endl <<
+		"gular expression does not match, the line is ignored. Full line must" << std::endl <<
+		"be matched." << std::endl <<
+		"These expressions are roughly equivalent to the built-in scanner:" << std::endl <<
 		"    IPv4: " << default_regex::IPv4 << std::endl <<
 		"    IPv6: " << default_regex::IPv6 << std::endl <<
-		"Custom regular expression can be provided in lieu of a default one by" << std::endl <<
-		"filling a fourth command line parameter." << std::endl << 
+		"Binary RIB dumps in the MRT format (TABLE_DUMP_V2) are recognised and" << std::endl <<
+		"read directly. The prefixes of the unicast RIB records are used." << std::endl <<
+		"Inputs compressed with gzip, bzip2 or zstd are decompressed while they" << std::endl <<
+		"are read, if support for the format was built in. A file name of '-'" << std::endl <<
+		"reads standard input. Standard input and named pipes are parsed while" << std::endl <<
+		"they are being written." << std::endl <<
 		std::endl <<
 		"Output:" << std::endl <<
 		"The program will perform an operation on sets of IP subnets A and B. " << std::endl <<
@@ -353,26 +2106,144 @@ void print_syntax()
 		" union:     The program will output the union of A and B (subnets ei-" << std::endl <<
 		"            ther in A or in B)."	<< std::endl <<
 		" intersect: The program will output the intersection of A and B (sub-" << std::endl <<
-		"            nets both in A and in B)." << std::endl;
+		"            nets both in A and in B)." << std::endl <<
+		std::endl <<
+		"The following operations take any number of files and compare them in" << std::endl <<
+		"one pass. Every subnet is followed by a hexadecimal bitmask of the fi-" << std::endl <<
+		"les it is in, the first file being the lowest bit." << std::endl <<
+		" all:       Subnets that are in all the files." << std::endl <<
+		" atleast k: Subnets that are in at least k of the files." << std::endl <<
+		" missing:   Subnets that are in some of the files, but not in all." << std::endl <<
+		std::endl <<
+		" compile:   The program will write a binary snapshot of the subnets in" << std::endl <<
+		"            the file, merged into the fewest disjoint subnets. It loads" << std::endl <<
+		"            without parsing and can be used in place of the file by all" << std::endl <<
+		"            operations, which give the same results as with -c." << std::endl <<
+		" aggregate: The program will output the subnets in the file, merged into" << std::endl <<
+		"            the fewest disjoint subnets." << std::endl;
 }
 
+// The benchmarks in bench/ include this file without its main()
+#ifndef BGPCOMPARE_NO_MAIN
+
 int main(int argc, char *argv[])
 {
 	const char* invalid_options = "Invalid command line parameters (use -h switch for help)";
 
 	try {
-		std::string regex;
+		Options options;
+		std::string output_file;
+		bool line_buffered = false;
+
+		// Options may appear anywhere on the command line; everything else is
+		// a positional parameter.
+		std::vector<std::string> args;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string param(argv[i]);
+			if (param == "-o" || param == "/o")
+			{
+				if (++i == argc)
+					throw std::runtime_error(invalid_options);
+				output_file = argv[i];
+			}
+			else if (param == "-l" || param == "/l")
+				line_buffered = true;
+			else if (param == "-j" || param == "/j")
+			{
+				if (++i == argc || atoi(argv[i]) < 1)
+					throw std::runtime_error(invalid_options);
+				options.threads = atoi(argv[i]);
+			}
+			else if (param == "-s" || param == "/s")
+				options.skip_invalid = true;
+			else if (param == "-S" || param == "/S")
+				options.streaming = true;
+			else if (param == "-x" || param == "/x")
+				options.exact = true;
+			else if (param == "-c" || param == "/c")
+				options.coalesce = true;
+			else if (param == "-r" || param == "/r")
+			{
+				if (++i == argc)
+					throw std::runtime_error(invalid_options);
+				options.regex = argv[i];
+			}
+			else
+				args.push_back(param);
+		}
+
+		if (!args.empty() && (args[0] == "compile" || args[0] == "aggregate"))
+		{
+			if (args.size() != 3)
+				throw std::runtime_error(invalid_options);
+
+			bool snapshot = args[0] == "compile";
+			OutputBuffer output(output_file, line_buffered && !snapshot);
+
+			if (args[1] == "-6" || args[1] == "/6" || args[1] == "ipv6")
+			{
+				if (snapshot)
+					compile<IPAddress::IPv6>(args[2], options, output);
+				else
+					aggregate<IPAddress::IPv6>(args[2], options, output);
+			}
+			else if (args[1] == "-4" || args[1] == "/4" || args[1] == "ipv4")
+			{
+				if (snapshot)
+					compile<IPAddress::IPv4>(args[2], options, output);
+				else
+					aggregate<IPAddress::IPv4>(args[2], options, output);
+			}
+			else
+				throw std::runtime_error(invalid_options);
+
+			output.flush();
+			return 0;
+		}
+
+		if (!args.empty() && (args[0] == "all" || args[0] == "atleast" || args[0] == "missing"))
+		{
+			std::string kernel_type = args[0];
+			size_t minimum = 0, first = 1;
+
+			if (kernel_type == "atleast")
+			{
+				// k is a whole number from 1 to the number of files
+				if (args.size() < 2 || args[1].find_first_not_of("0123456789") != std::string::npos)
+					throw std::runtime_error(invalid_options);
+				minimum = strtoul(args[1].c_str(), nullptr, 10);
+				first = 2;
+			}
+
+			if (args.size() < first + 2)
+				throw std::runtime_error(invalid_options);
+
+			std::string address_family = args[first];
+			std::vector<std::string> files(args.begin() + first + 1, args.end());
+			if (kernel_type == "atleast" && (minimum < 1 || minimum > files.size()))
+				throw std::runtime_error(invalid_options);
+			OutputBuffer output(output_file, line_buffered);
+
+			if (address_family == "-6" || address_family == "/6" ||  address_family == "ipv6")
+				process_sources<IPAddress::IPv6>(kernel_type, minimum, files, options, output);
+			else if (address_family == "-4" || address_family == "/4" ||  address_family == "ipv4")
+				process_sources<IPAddress::IPv4>(kernel_type, minimum, files, options, output);
+			else
+				throw std::runtime_error(invalid_options);
+
+			output.flush();
+			return 0;
+		}
 
-		switch (argc)
+		switch (args.size())
 		{
 		case 0:
-		case 1:
 			print_syntax();
 			return 0;
-		case 2:
+		case 1:
 			{
-				std::string param(argv[1]);
-				if (param == "-h" || param == "/h" || param == "/?")
+				if (args[0] == "-h" || args[0] == "/h" || args[0] == "/?")
 				{
 					print_syntax();
 					return 0;
@@ -380,33 +2251,31 @@ int main(int argc, char *argv[])
 				else
 					throw std::runtime_error(invalid_options);
 			}
-		case 6:
-			regex = argv[5];
-		case 5:		
+		case 5:
+			options.regex = args[4];
+		case 4:		
 			{
-				std::string kernel_type = argv[1];
-				std::string address_family = argv[2];
+				std::string kernel_type = args[0];
+				std::string address_family = args[1];
 
-				std::unique_ptr<ComparisonKernel> kernel;
+				if (kernel_type != "diff" && kernel_type != "union" && kernel_type != "intersect")
+					throw std::runtime_error(invalid_options);
 
-				if (kernel_type == "diff")  kernel.reset(new DifferenceKernel()); else
-					if (kernel_type == "union") kernel.reset(new UnionKernel()); else
-						if (kernel_type == "intersect") kernel.reset(new IntersectionKernel()); else
-							throw std::runtime_error(invalid_options);
+				OutputBuffer output(output_file, line_buffered);
 
 				if (address_family == "-6" || address_family == "/6" ||  address_family == "ipv6")
 				{
-					if (argc == 5) regex = default_regex::IPv6;
-					process<IPAddress::IPv6>(argv[3], argv[4], regex, *kernel.get());
+					process<IPAddress::IPv6>(kernel_type, args[2], args[3], options, output);
 				}
 				else
 					if (address_family == "-4" || address_family == "/4" ||  address_family == "ipv4")
 					{
-						if (argc == 5) regex = default_regex::IPv4;
-						process<IPAddress::IPv4>(argv[3], argv[4], regex, *kernel.get());
+						process<IPAddress::IPv4>(kernel_type, args[2], args[3], options, output);
 					}
 					else
 						throw std::runtime_error(invalid_options);
+
+				output.flush();
 				break;
 			}
 		default: 
@@ -421,3 +2290,5 @@ int main(int argc, char *argv[])
 
 	return 0;
 }
+
+#endif
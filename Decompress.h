@@ -0,0 +1,351 @@
+/*
+Decompress.h - detection of compressed inputs and streaming decompression
+			   of gzip, bzip2 and zstd data
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include<string>
+#include<cstring>
+#include<memory>
+#include<functional>
+#include<stdexcept>
+#include<algorithm>
+
+// Each format is only supported if the program is built with the matching
+// flag (and linked with the library): -DUSE_ZLIB (-lz), -DUSE_BZIP2 (-lbz2)
+// and -DUSE_ZSTD (-lzstd).
+
+#ifdef USE_ZLIB
+	#include<zlib.h>
+#endif
+#ifdef USE_BZIP2
+	#include<bzlib.h>
+#endif
+#ifdef USE_ZSTD
+	#include<zstd.h>
+#endif
+
+enum Compression
+{
+	compression_none,
+	compression_gzip,
+	compression_bzip2,
+	compression_zstd
+};
+
+// Magic bytes are at most this long, so the format is known once this many
+// bytes have arrived (or all of the data, if it is shorter)
+const size_t compression_magic_length = 4;
+
+// Recognises the format by the magic bytes at the start of the data
+inline Compression detect_compression(const char* begin, const char* end)
+{
+	size_t size = end - begin;
+
+	if (size >= 2 && memcmp(begin, "\x1f\x8b", 2) == 0)
+		return compression_gzip;
+	if (size >= 3 && memcmp(begin, "BZh", 3) == 0)
+		return compression_bzip2;
+	if (size >= 4 && memcmp(begin, "\x28\xb5\x2f\xfd", 4) == 0)
+		return compression_zstd;
+
+	return compression_none;
+}
+
+// Provides compressed data in blocks, which stay valid until the following
+// call. Returns false at the end of the data.
+typedef std::function<bool(const char*& begin, const char*& end)> BlockSource;
+
+// Decompressors fill a buffer with at most size bytes and return how many,
+// or 0 at the end of the data (see InputStream::Reader). Like read(), they
+// return what they have once the input that has arrived is used up, rather
+// than wait for more of it to fill the buffer. Concatenated streams are
+// decompressed one after another, as by the command line tools.
+typedef std::function<size_t(char* buffer, size_t size)> Decompressor;
+
+#ifdef USE_ZLIB
+class GzipDecompressor
+{
+private:
+	BlockSource source_;
+	std::string file_;
+	z_stream stream_;
+	bool inside_;
+
+	GzipDecompressor(const GzipDecompressor&);
+	GzipDecompressor& operator = (const GzipDecompressor&);
+public:
+	GzipDecompressor(const BlockSource& source, const std::string& file_name) :
+		source_(source), file_(file_name), inside_(false)
+	{
+		memset(&stream_, 0, sizeof(stream_));
+
+		// 32 selects automatic detection of the gzip header
+		if (inflateInit2(&stream_, 15 + 32) != Z_OK)
+			throw std::runtime_error("Cannot decompress gzip data in " + file_);
+	}
+
+	~GzipDecompressor()
+	{
+		inflateEnd(&stream_);
+	}
+
+	size_t read(char* buffer, size_t size)
+	{
+		stream_.next_out = reinterpret_cast<Bytef*>(buffer);
+		stream_.avail_out = static_cast<uInt>(size);
+
+		while (stream_.avail_out != 0)
+		{
+			if (stream_.avail_in == 0)
+			{
+				if (stream_.avail_out != size)
+					break;
+
+				const char *begin, *end;
+				if (!source_(begin, end))
+				{
+					if (inside_)
+						throw std::runtime_error("Truncated gzip data in " + file_);
+					break;
+				}
+				stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(begin));
+				stream_.avail_in = static_cast<uInt>(end - begin);
+				continue;
+			}
+
+			int result = inflate(&stream_, Z_NO_FLUSH);
+			if (result == Z_STREAM_END)
+			{
+				inside_ = false;
+				inflateReset(&stream_);
+			}
+			else if (result == Z_OK || result == Z_BUF_ERROR)
+				inside_ = true;
+			else
+				throw std::runtime_error("Invalid gzip data in " + file_);
+		}
+
+		return size - stream_.avail_out;
+	}
+};
+#endif
+
+#ifdef USE_BZIP2
+class Bzip2Decompressor
+{
+private:
+	BlockSource source_;
+	std::string file_;
+	bz_stream stream_;
+	bool inside_;
+
+	Bzip2Decompressor(const Bzip2Decompressor&);
+	Bzip2Decompressor& operator = (const Bzip2Decompressor&);
+public:
+	Bzip2Decompressor(const BlockSource& source, const std::string& file_name) :
+		source_(source), file_(file_name), inside_(false)
+	{
+		memset(&stream_, 0, sizeof(stream_));
+		if (BZ2_bzDecompressInit(&stream_, 0, 0) != BZ_OK)
+			throw std::runtime_error("Cannot decompress bzip2 data in " + file_);
+	}
+
+	~Bzip2Decompressor()
+	{
+		BZ2_bzDecompressEnd(&stream_);
+	}
+
+	size_t read(char* buffer, size_t size)
+	{
+		stream_.next_out = buffer;
+		stream_.avail_out = static_cast<unsigned int>(size);
+
+		while (stream_.avail_out != 0)
+		{
+			if (stream_.avail_in == 0)
+			{
+				if (stream_.avail_out != size)
+					break;
+
+				const char *begin, *end;
+				if (!source_(begin, end))
+				{
+					if (inside_)
+						throw std::runtime_error("Truncated bzip2 data in " + file_);
+					break;
+				}
+				stream_.next_in = const_cast<char*>(begin);
+				stream_.avail_in = static_cast<unsigned int>(end - begin);
+				continue;
+			}
+
+			int result = BZ2_bzDecompress(&stream_);
+			if (result == BZ_STREAM_END)
+			{
+				// The state cannot be reset, so it is created again for the
+				// next stream, keeping the remaining input.
+				char* next_in = stream_.next_in;
+				unsigned int avail_in = stream_.avail_in;
+				char* next_out = stream_.next_out;
+				unsigned int avail_out = stream_.avail_out;
+
+				BZ2_bzDecompressEnd(&stream_);
+				memset(&stream_, 0, sizeof(stream_));
+				if (BZ2_bzDecompressInit(&stream_, 0, 0) != BZ_OK)
+					throw std::runtime_error("Cannot decompress bzip2 data in " + file_);
+
+				stream_.next_in = next_in;
+				stream_.avail_in = avail_in;
+				stream_.next_out = next_out;
+				stream_.avail_out = avail_out;
+				inside_ = false;
+			}
+			else if (result == BZ_OK)
+				inside_ = true;
+			else
+				throw std::runtime_error("Invalid bzip2 data in " + file_);
+		}
+
+		return size - stream_.avail_out;
+	}
+};
+#endif
+
+#ifdef USE_ZSTD
+class ZstdDecompressor
+{
+private:
+	BlockSource source_;
+	std::string file_;
+	ZSTD_DStream* stream_;
+	ZSTD_inBuffer input_;
+	bool inside_;
+
+	ZstdDecompressor(const ZstdDecompressor&);
+	ZstdDecompressor& operator = (const ZstdDecompressor&);
+public:
+	ZstdDecompressor(const BlockSource& source, const std::string& file_name) :
+		source_(source), file_(file_name), stream_(ZSTD_createDStream()), inside_(false)
+	{
+		if (stream_ == nullptr)
+			throw std::runtime_error("Cannot decompress zstd data in " + file_);
+		ZSTD_initDStream(stream_);
+		input_.src = nullptr;
+		input_.size = input_.pos = 0;
+	}
+
+	~ZstdDecompressor()
+	{
+		ZSTD_freeDStream(stream_);
+	}
+
+	size_t read(char* buffer, size_t size)
+	{
+		ZSTD_outBuffer output = { buffer, size, 0 };
+
+		while (output.pos != size)
+		{
+			if (input_.pos == input_.size)
+			{
+				if (output.pos != 0)
+					break;
+
+				const char *begin, *end;
+				if (!source_(begin, end))
+				{
+					if (inside_)
+						throw std::runtime_error("Truncated zstd data in " + file_);
+					break;
+				}
+				input_.src = begin;
+				input_.size = end - begin;
+				input_.pos = 0;
+				continue;
+			}
+
+			// Returns 0 at the end of a frame, and the next frame follows
+			size_t result = ZSTD_decompressStream(stream_, &output, &input_);
+			if (ZSTD_isError(result))
+				throw std::runtime_error("Invalid zstd data in " + file_);
+			inside_ = result != 0;
+		}
+
+		return output.pos;
+	}
+};
+#endif
+
+template<typename D>
+Decompressor make_decompressor(const BlockSource& source, const std::string& file_name)
+{
+	// Decompressors are not copyable, so the function shares one
+	std::shared_ptr<D> decompressor(new D(source, file_name));
+	return [decompressor](char* buffer, size_t size) { return decompressor->read(buffer, size); };
+}
+
+// Returns a decompressor for data in the given format. Throws if support
+// for it was not built in.
+inline Decompressor decompressor(Compression compression, const BlockSource& source,
+	const std::string& file_name)
+{
+	switch (compression)
+	{
+	case compression_gzip:
+#ifdef USE_ZLIB
+		return make_decompressor<GzipDecompressor>(source, file_name);
+#else
+		(void) source;
+		throw std::runtime_error(file_name + " is compressed with gzip (build with -DUSE_ZLIB to read it)");
+#endif
+	case compression_bzip2:
+#ifdef USE_BZIP2
+		return make_decompressor<Bzip2Decompressor>(source, file_name);
+#else
+		(void) source;
+		throw std::runtime_error(file_name + " is compressed with bzip2 (build with -DUSE_BZIP2 to read it)");
+#endif
+	case compression_zstd:
+#ifdef USE_ZSTD
+		return make_decompressor<ZstdDecompressor>(source, file_name);
+#else
+		(void) source;
+		throw std::runtime_error(file_name + " is compressed with zstd (build with -DUSE_ZSTD to read it)");
+#endif
+	default:
+		throw std::logic_error("Input is not compressed");
+	}
+}
+
+// Hands out data that is already in memory (such as a mapped file) in
+// pieces that the decompressors can take in one call
+inline BlockSource memory_blocks(const char* begin, const char* end)
+{
+	static const size_t piece = 1 << 24;
+	std::shared_ptr<const char*> next(new const char*(begin));
+
+	return [next, end](const char*& piece_begin, const char*& piece_end) {
+		if (*next == end)
+			return false;
+		piece_begin = *next;
+		piece_end = *next + std::min<size_t>(piece, end - *next);
+		*next = piece_end;
+		return true;
+	};
+}
@@ -21,59 +21,216 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include<string>
-#include<sstream>
-#include<vector>
 #include<cstdint>
 #include<stdexcept>
 
+// IPv6 arithmetic and comparisons are done on a native 128-bit integer where
+// the compiler provides one. Define IPADDRESS_NO_INT128 to use the portable
+// two-word implementation instead.
+#if defined(__SIZEOF_INT128__) && !defined(IPADDRESS_NO_INT128)
+	#define IPADDRESS_HAVE_INT128
+#endif
+
+// On x86 compilers that understand the target attribute, dotted quads are
+// parsed with SSE4.1 when the processor supports it. Define IPADDRESS_NO_SIMD
+// to always use the scalar parser.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(IPADDRESS_NO_SIMD)
+	#define IPADDRESS_HAVE_SSE
+	#include<cstring>
+	#include<immintrin.h>
+#endif
+
 namespace IPAddress {
 
+	namespace bits {
+		// Both are undefined for 0
+		inline int trailing_zeros(uint64_t value) {
+#if defined(__GNUC__)
+			return __builtin_ctzll(value);
+#else
+			int count = 0;
+			for (; !(value & 1); value >>= 1) count++;
+			return count;
+#endif
+		}
+
+		inline int leading_zeros(uint64_t value) {
+#if defined(__GNUC__)
+			return __builtin_clzll(value);
+#else
+			int count = 0;
+			for (; !(value & 0x8000000000000000); value <<= 1) count++;
+			return count;
+#endif
+		}
+	}
+
+#ifdef IPADDRESS_HAVE_SSE
+	namespace sse {
+		template<int Dummy = 0>
+		struct ipv4_tables
+		{
+			// Shuffle patterns that move the digits of each octet into its own
+			// 32-bit lane as (hundreds, tens, ones, 0), indexed by the lengths of
+			// the four octets written as a base 3 number.
+			static uint8_t shuffle[81][16];
+			static const bool supported;
+
+			static bool initialize()
+			{
+				for (int index = 0; index < 81; index++)
+				{
+					int position = 0;
+					for (int octet = 0, divisor = 27; octet < 4; octet++, divisor /= 3)
+					{
+						int length = index / divisor % 3 + 1;
+						for (int i = 0; i < 4; i++)
+						{
+							int digit = i - (3 - length);
+							shuffle[index][octet * 4 + i] = (i < 3 && digit >= 0) ? position + digit : 0x80;
+						}
+						position += length + 1;
+					}
+				}
+
+				__builtin_cpu_init();
+				return __builtin_cpu_supports("sse4.1");
+			}
+		};
+
+		template<int Dummy>
+		uint8_t ipv4_tables<Dummy>::shuffle[81][16];
+
+		// Until this is initialized, the scalar parser is used
+		template<int Dummy>
+		const bool ipv4_tables<Dummy>::supported = ipv4_tables<Dummy>::initialize();
+
+		// Recognises dotted quads with one to three digits per octet. Anything
+		// else, including valid addresses with longer zero-padded octets, is
+		// rejected and left to the scalar parser.
+		__attribute__((target("sse4.1")))
+		inline bool parse_ipv4(const char* begin, const char* end, uint32_t& value)
+		{
+			const size_t length = end - begin;
+			if (length < 7 || length > 15)
+				return false;
+
+			// The bytes after the address may not belong to the caller's buffer,
+			// so it is put together from loads that stay within it, overlapping
+			// where it is shorter than they are. Copying it to a local buffer
+			// would stall the vector load until the copy is complete.
+			uint64_t low, high = 0;
+			if (length >= 8)
+			{
+				memcpy(&low, begin, 8);
+				if (length > 8)
+				{
+					memcpy(&high, end - 8, 8);
+					high >>= (16 - length) * 8;
+				}
+			}
+			else
+			{
+				uint32_t first, last;
+				memcpy(&first, begin, 4);
+				memcpy(&last, end - 4, 4);
+				low = first | static_cast<uint64_t>(last) << 24;
+			}
+			const __m128i input = _mm_set_epi64x(static_cast<long long>(high), static_cast<long long>(low));
+
+			const __m128i inside = _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(length)),
+				_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+			const __m128i digits = _mm_sub_epi8(input, _mm_set1_epi8('0'));
+			const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+			const __m128i is_dot = _mm_cmpeq_epi8(input, _mm_set1_epi8('.'));
+			const __m128i invalid = _mm_andnot_si128(_mm_or_si128(is_digit, is_dot), inside);
+			if (!_mm_testz_si128(invalid, invalid))
+				return false;
+
+			unsigned dots = _mm_movemask_epi8(_mm_and_si128(is_dot, inside));
+			if (__builtin_popcount(dots) != 3)
+				return false;
+
+			const unsigned first = __builtin_ctz(dots);
+			dots &= dots - 1;
+			const unsigned second = __builtin_ctz(dots);
+			dots &= dots - 1;
+			const unsigned third = __builtin_ctz(dots);
+
+			// Lengths are decremented so that empty octets wrap around
+			const unsigned lengths[4] = { first - 1, second - first - 2,
+				third - second - 2, static_cast<unsigned>(length) - third - 2 };
+			if (lengths[0] > 2 || lengths[1] > 2 || lengths[2] > 2 || lengths[3] > 2)
+				return false;
+
+			const int index = lengths[0] * 27 + lengths[1] * 9 + lengths[2] * 3 + lengths[3];
+			__m128i octets = _mm_shuffle_epi8(digits, _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(ipv4_tables<>::shuffle[index])));
+			octets = _mm_maddubs_epi16(octets,
+				_mm_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0));
+			octets = _mm_madd_epi16(octets, _mm_set1_epi16(1));
+
+			const __m128i overflow = _mm_cmpgt_epi32(octets, _mm_set1_epi32(255));
+			if (!_mm_testz_si128(overflow, overflow))
+				return false;
+
+			value = _mm_cvtsi128_si32(_mm_shuffle_epi8(octets,
+				_mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+			return true;
+		}
+	}
+#endif
+
 	class IPv4
 	{
 	private:
 		// This parser considers IPv4 addresses with leading zeros in parts valid.
-		// Leading zeros do not signify octal notation
+		// Leading zeros do not signify octal notation. Returns false if the text
+		// is not a valid address.
 
-		void parse(std::string::const_iterator begin, 
-			std::string::const_iterator end)  {
+		template<typename Iterator>
+		bool parse(Iterator begin, Iterator end)  {
 				value = 0;
 				int octet = 0, count = 0;
 
-				std::string invalid_format = "Invalid IPv4 format (" + std::string(begin, end) + ")";
-
-				if (*begin == '.') 
-					throw std::runtime_error(invalid_format);
+				if (begin == end || *begin == '.')
+					return false;
 
-				for (auto iter = begin; 
+				for (auto iter = begin;
 					iter != end; ++iter)
 				{
-					if (*iter <= '9' && *iter >= '0') 
+					if (*iter <= '9' && *iter >= '0')
+					{
 						octet = octet * 10 + (*iter - '0');
+						if (octet >= 256)
+							return false;
+					}
 					else
-						if (*iter == '.' && octet < 256)
+						if (*iter == '.')
 						{
 							// There shouldn't be a ".." anywhere in the address,
 							// nor should an address end with "."
 							if (iter + 1 == end)
-								throw std::runtime_error(invalid_format);
+								return false;
 							else
 								if (*(iter + 1) == '.')
-									throw std::runtime_error(invalid_format);
+									return false;
 
 							value = (value << 8) | octet;
 							octet = 0;
-							count ++;					
+							count ++;
 						}
 						else
-							// If there are unknown characrers or if number is >= 256
-							throw std::runtime_error(invalid_format);
+							// If there are unknown characrers
+							return false;
 				}
 
 				// Till this point three octets should've been read.
-				if (count != 3 || octet >= 256)
-					throw std::runtime_error(invalid_format);
+				if (count != 3)
+					return false;
 
 				value = (value << 8) | octet;
+				return true;
 		}
 
 	public:
@@ -91,28 +248,96 @@ namespace IPAddress {
 			return IPv4(value | (~ (0xffffffff << (32 - prefix))));
 		};
 
+		// i-th byte of the address in network order, eg. for radix sorting
+		static const int byte_length = 4;
+		uint8_t byte(const int i) const {
+			return (value >> (24 - i * 8)) & 0xff;
+		}
+
+		// Conversion to and from byte_length bytes in network order, for
+		// compact storage of addresses
+		void to_bytes(uint8_t* out) const {
+			out[0] = value >> 24; out[1] = value >> 16;
+			out[2] = value >> 8;  out[3] = value;
+		}
+
+		static IPv4 from_bytes(const uint8_t* in) {
+			return IPv4((static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+				(static_cast<uint32_t>(in[2]) << 8) | in[3]);
+		}
+
+		// Prefix length of the largest block that starts at this address and
+		// does not extend past last (which must not be lower than this address)
+		short largest_block(const IPv4& last) const {
+			uint64_t size = static_cast<uint64_t>(last.value) - value + 1;
+			int size_bits = 63 - bits::leading_zeros(size);
+			int align_bits = value == 0 ? 32 : bits::trailing_zeros(value);
+			return 32 - (size_bits < align_bits ? size_bits : align_bits);
+		}
+
+		static const int max_string_length = 15;
+		static const int min_string_length = 7;  // "0.0.0.0"
+
+		// Writes the textual representation into a caller-provided buffer of at
+		// least max_string_length characters and returns a pointer past its end.
+		char* format(char* out) const {
+			for (int shift = 24; shift >= 0; shift -= 8)
+			{
+				unsigned int octet = (value >> shift) & 0xff;
+				if (octet >= 100) *out++ = '0' + octet / 100;
+				if (octet >= 10)  *out++ = '0' + (octet / 10) % 10;
+				*out++ = '0' + octet % 10;
+				if (shift != 0)   *out++ = '.';
+			}
+			return out;
+		}
+
 		std::string to_string() const {
-			std::stringstream buf;
-			buf << std::dec << ((value >> 24) & 0xff) << "."
-				<< std::dec << ((value >> 16) & 0xff)  << "."
-				<< std::dec << ((value >> 8)  & 0xff) << "."
-				<< std::dec << ((value >> 0)  & 0xff);
-			return buf.str();
+			char buf[max_string_length];
+			return std::string(buf, format(buf));
 		}
 
 		IPv4() : value(0) {};
 
 		IPv4(uint32_t value_) : value(value_) {};
 
-		IPv4(std::string::const_iterator begin, 
+		IPv4(std::string::const_iterator begin,
 			std::string::const_iterator end) {
-				parse(begin, end);
+				if (!try_parse(begin, end, *this))
+					throw std::runtime_error(parse_error(begin, end));
+		}
+
+		IPv4(const char* begin, const char* end) {
+			if (!try_parse(begin, end, *this))
+				throw std::runtime_error(parse_error(begin, end));
 		}
 
 		IPv4(const std::string& text) {
-			parse(text.cbegin(),text.cend());
+			if (!try_parse(text.data(), text.data() + text.size(), *this))
+				throw std::runtime_error(parse_error(text.cbegin(), text.cend()));
 		};
 
+		// Non-throwing counterparts of the constructors above, for callers that
+		// expect invalid input. Return false if the text is not a valid address.
+		template<typename Iterator>
+		static bool try_parse(Iterator begin, Iterator end, IPv4& address) {
+			return address.parse(begin, end);
+		}
+
+		static bool try_parse(const char* begin, const char* end, IPv4& address) {
+#ifdef IPADDRESS_HAVE_SSE
+			if (sse::ipv4_tables<>::supported && sse::parse_ipv4(begin, end, address.value))
+				return true;
+#endif
+			return address.parse(begin, end);
+		}
+
+		// Describes a failed parse. Only built when the error is reported.
+		template<typename Iterator>
+		static std::string parse_error(Iterator begin, Iterator end) {
+			return "Invalid IPv4 format (" + std::string(begin, end) + ")";
+		}
+
 		static IPv4 subnet_mask(const short prefix)
 		{
 			if (prefix < 0 || prefix > 32) 
@@ -120,14 +345,14 @@ namespace IPAddress {
 			return IPv4(0xffffff << (32-prefix));
 		}
 
-		IPv4 next(const short prefix = bit_length)
+		IPv4 next(const short prefix = bit_length) const
 		{
 			if (prefix < 0 || prefix > bit_length) 
 				throw std::runtime_error("Invalid prefix size");
 			return IPv4(value + (1 << (32-prefix)));
 		}
 
-		IPv4 previous(const short prefix = bit_length)
+		IPv4 previous(const short prefix = bit_length) const
 		{
 			if (prefix < 0 || prefix > bit_length) 
 				throw std::runtime_error("Invalid prefix size");
@@ -168,212 +393,204 @@ namespace IPAddress {
 	class IPv6 
 	{
 	private:
-		typedef std::vector<uint16_t> segment_vector;
-
-		segment_vector segmentize() const
+		void segmentize(uint16_t* segments) const
 		{
-			segment_vector segments(8);
-
 			for (int i=0; i < 4; i ++ )
 			{
 				segments[i] =   (network >> (48 - i * 16))  & 0xffff;
 				segments[i+4] = (host >> (48 - i * 16))  & 0xffff;
 			}
-
-			return segments;
 		}
 
-		std::string collapse(segment_vector::const_iterator begin, segment_vector::const_iterator end) const
+		static char* format_hex(uint16_t segment, char* out, int min_digits = 1)
 		{
-			std::stringstream buf;
+			static const char digits[] = "0123456789abcdef";
 
-			segment_vector::const_iterator collapse(end), 
-				collapse_start(end), collapse_end(end);
+			for (int shift = 12; shift >= 0; shift -= 4)
+				if ((segment >> shift) != 0 || shift < min_digits * 4)
+					*out++ = digits[(segment >> shift) & 0xf];
+			return out;
+		}
 
-			for (auto iter = begin; iter != end; ++iter)
-			{
-				if (*iter == 0)
-				{
-					if (collapse == end)
-						collapse = iter;
+		static char* collapse(const uint16_t* begin, const uint16_t* end, char* out)
+		{
+			const uint16_t *collapse_start(end), *collapse_end(end);
 
-				} else
+			for (auto iter = begin; iter != end; )
+			{
+				if (*iter != 0)
 				{
-					if (collapse != end)
-					{
-						// Strictly greater than, because first occurence of multiple 0's
-						// must be collapsed as per RFC 5952
-						if (iter - collapse > collapse_end - collapse_start)
-						{
-							collapse_start = collapse;
-							collapse_end   = iter;
-						}
-						collapse = end;					
-					}
+					++iter;
+					continue;
 				}
-			}
 
-			// In the case of "::" at the end.
-			if (collapse != end) 
-			{
-				if ( end - collapse > collapse_end - collapse_start )
+				auto run_end = iter;
+				while (run_end != end && *run_end == 0)
+					++run_end;
+
+				// Strictly greater than, because first occurence of multiple 0's
+				// must be collapsed as per RFC 5952
+				if (run_end - iter > collapse_end - collapse_start)
 				{
-					collapse_start = collapse;
-					collapse_end   = end;
+					collapse_start = iter;
+					collapse_end   = run_end;
 				}
-				collapse = end;		
+				iter = run_end;
 			}
 
 			// If longest consectutive chain is 1 segment long, we do not collapse
 			if (collapse_end - collapse_start == 1)
-				collapse_start = end;
+				collapse_start = collapse_end = end;
 
 			for (auto iter = begin; iter != end; ++iter)
 			{
 				if (iter == collapse_start)
-					buf << "::";
-				if (iter >= collapse_start && iter < collapse_end)
+				{
+					*out++ = ':';
+					*out++ = ':';
+					iter = collapse_end - 1;
 					continue;
-				buf << std::hex << *iter;
+				}
+				out = format_hex(*iter, out);
 				if (iter + 1 != end && iter + 1 != collapse_start)
-					buf << ":";
+					*out++ = ':';
 			}
 
-			return buf.str();
+			return out;
 		}
 
-		uint16_t parse_segment(std::string::const_iterator begin, 
-			std::string::const_iterator end)
+		// Value of a hexadecimal digit, or 0xff for any other character
+		static uint8_t hex_digit(const char c)
 		{
-			std::stringstream buf(std::string(begin,end));
-			uint16_t result;
-			buf >> std::hex >> result;
-			return result;
+			static const uint8_t digits[256] = {
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,255,255,255,255,255,255,
+				255, 10, 11, 12, 13, 14, 15,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255, 10, 11, 12, 13, 14, 15,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+				255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255
+			};
+			return digits[static_cast<uint8_t>(c)];
 		}
 
 		// This parser has been validated with test cases that are provided in
-		// http://download.dartware.com/thirdparty/test-ipv6-regex.pl.
+		// http://download.dartware.com/thirdparty/test-ipv6-regex.pl. Returns
+		// false if the text is not a valid address.
 
-		void parse(std::string::const_iterator begin, 
-			std::string::const_iterator end) {
+		template<typename Iterator>
+		bool parse(Iterator begin, Iterator end) {
 				network = 0; host = 0;
 
-				std::string invalid_format = "Invalid IPv6 format (" + std::string(begin, end) + ")";
+				uint16_t segments[8];
+				int count = 0;
 
-				segment_vector segments_first, segments_second;
-				segment_vector* segments = &segments_first;
+				// Number of segments before the "::", or -1 if there is none
+				int gap = -1;
 
 				auto iter = begin;
 
 				// If address begins with ":", it should be valid only in case that
 				// "::" is at the beginning.
-				if (*begin == ':')
+				if (iter != end && *iter == ':')
 				{
-					if (*(begin+1) != ':')
-						throw std::runtime_error(invalid_format);
-					segments = &segments_second;
-					iter += 2;
+					if (++iter == end || *iter != ':')
+						return false;
+					gap = 0;
+					++iter;
 				}
 
-				auto segment_start = iter,
-					segment_end = iter;
-				bool IPv4_embedded = false;
-
-				for (; iter != end; ++iter)
+				while (iter != end)
 				{
-					if ((*iter >= 'a' && *iter <= 'f') ||
-						(*iter >= 'A' && *iter <= 'F') ||
-						(*iter >= '0' && *iter <= '9'))
+					auto segment_start = iter;
+					unsigned int segment = 0;
+					uint8_t digit;
+
+					for (; iter != end && (digit = hex_digit(*iter)) != 0xff; ++iter)
+						segment = (segment << 4) | digit;
+
+					// If there is a "." in the segment, we assume that the rest of an address
+					// is IPv4.
+					if (iter != end && *iter == '.')
 					{
-						continue;
+						IPv4 embedded_part;
+						if (count > 6 || !IPv4::try_parse(segment_start, end, embedded_part))
+							return false;
+						segments[count++] = embedded_part.value >> 16;
+						segments[count++] = embedded_part.value & 0xffff;
+						break;
 					}
-					else if (*iter == ':')
-					{
-						segment_end = iter;
 
-						// No more than 4 characters per segment
-						if (segment_end - segment_start > 4) 
-							throw std::runtime_error(invalid_format);				
+					// No more than 4 characters per segment
+					if (iter == segment_start || iter - segment_start > 4 || count == 8)
+						return false;
+					segments[count++] = segment;
 
-						// Indicates a "::". Should only be valid if there hasn't
-						// been one till this point.
-						if (segment_end - segment_start == 0) 
-						{
-							if (segments == &segments_second)
-								// Ve kot en :: na naslov
-								throw std::runtime_error(invalid_format);
-							else
-								segments = &segments_second;
-						} else
-							segments->push_back(parse_segment(segment_start,segment_end));
+					if (iter == end)
+						break;
 
-						segment_start = iter + 1;
+					// Invalid characters in input, or an address that ends with a
+					// single ":"
+					if (*iter != ':' || ++iter == end)
+						return false;
 
-						// If there is a "." in the segment, we assume that the rest of an address
-						// is IPv4.
-					} else if (*iter == '.') 
+					// Indicates a "::". Should only be valid if there hasn't
+					// been one till this point.
+					if (*iter == ':')
 					{
-						IPv4_embedded = true;
-						break;
+						if (gap >= 0)
+							// Ve kot en :: na naslov
+							return false;
+						gap = count;
+						++iter;
 					}
-					// Invalid characters in input.
-					else throw std::runtime_error(invalid_format);
-
 				}
 
-				if (*(end-1) == ':' && !(segments == &segments_second 
-					&& segments_second.size() == 0))
-					throw std::runtime_error(invalid_format);
-
-				if (IPv4_embedded)
-				{
-					IPv4 embedded_part(segment_start, end);
-					segments->push_back(embedded_part.value >> 16);
-					segments->push_back(embedded_part.value & 0xffff);
-				}
-				else
-					// If an address ends with "::", we should keep the second vector
-					// empty, even though adding a single 0x0000 would result in the same
-					// address. Doing so saves us one step on address verification.
-					if  (*(end-1) != ':')
-						segments->push_back(parse_segment(segment_start, end));
-
-				// If "::" is not present in the address.
-				if (segments == &segments_first)
-				{
-					if (segments_first.size() != 8)
-						throw std::runtime_error(invalid_format);
-				}
-				else
-				{
-					if (segments_first.size() + segments_second.size() >= 8)
-						throw std::runtime_error(invalid_format);
-				}
+				// Without "::" all eight segments must be present, and "::" must
+				// stand for at least one zero segment.
+				if (gap < 0 ? count != 8 : count >= 8)
+					return false;
 
-				// We iterate through the first segment vector and insert segments into
-				// appropriate adress parts.
-				for (segment_vector::size_type i=0; i < segments_first.size(); i++)
+				// Segments after the "::" are aligned to the end of the address
+				for (int i = 0; i < count; i++)
 				{
-					if (i < 4)
+					int position = (gap >= 0 && i >= gap) ? i + 8 - count : i;
+					if (position < 4)
 						network |= (static_cast<uint64_t>
-						(segments_first[i]) << ((3 - i) * 16));
+						(segments[i]) << ((3 - position) * 16));
 					else
 						host    |= (static_cast<uint64_t>
-						(segments_first[i]) << ((7 - i) * 16));
+						(segments[i]) << ((7 - position) * 16));
 				}
+				return true;
+		}
 
-				// We iterate through the first segment vector (backwards so as not to care
-				// how long a "::" is) and insert segments into appropriate adress parts.
-				for (segment_vector::size_type i=0; i < segments_second.size(); i++)
-				{
-					if (i < 4)
-						host |= (static_cast<uint64_t>
-						(segments_second[segments_second.size()-i-1]) << (i * 16));
-					else
-						network   |= (static_cast<uint64_t>
-						(segments_second[segments_second.size()-i-1]) << ((i-4) * 16));
-				}
+#ifdef IPADDRESS_HAVE_INT128
+		typedef unsigned __int128 uint128;
+
+		// The two public halves remain the storage, the compiler keeps them
+		// in a register pair and operates on them as a single value.
+		uint128 wide() const {
+			return (static_cast<uint128>(network) << 64) | host;
+		}
+
+		static IPv6 from_wide(const uint128 value) {
+			return IPv6(static_cast<uint64_t>(value >> 64), static_cast<uint64_t>(value));
+		}
+
+		static uint128 mask(const short prefix) {
+			return prefix == 0 ? 0 : ~static_cast<uint128>(0) << (128 - prefix);
 		}
+#endif
 
 	public:
 		static const int bit_length = 128;
@@ -381,65 +598,171 @@ namespace IPAddress {
 		uint64_t host;
 
 		IPv6 network_zeros(const short prefix = 0) const {
+#ifdef IPADDRESS_HAVE_INT128
+			return from_wide(wide() & mask(prefix));
+#else
 			if (prefix == 0) 
-				return IPv6(0,0);
+				return IPv6();
 			if (prefix > 64) 
 				return IPv6(network, host & (0xffffffffffffffff << (128 - prefix )));
 			else 
 				return IPv6(network & (0xffffffffffffffff << (64 - prefix )), 0);
+#endif
 		};
 
 		IPv6 network_ones (const short prefix = 0) const {		
+#ifdef IPADDRESS_HAVE_INT128
+			return from_wide(wide() | ~mask(prefix));
+#else
 			if (prefix == 0) 
 				return IPv6(0xffffffffffffffff,0xffffffffffffffff);
 			if (prefix > 64) 
 				return IPv6(network, host | (~ (0xffffffffffffffff << (128 - prefix )))); 
 			else 
 				return IPv6(network | (~(0xffffffffffffffff << (64 - prefix ))), 0xffffffffffffffff);	
+#endif
 		}; 
 
+		// i-th byte of the address in network order, eg. for radix sorting
+		static const int byte_length = 16;
+		uint8_t byte(const int i) const {
+			if (i < 8)
+				return (network >> (56 - i * 8)) & 0xff;
+			else
+				return (host >> (120 - i * 8)) & 0xff;
+		}
+
+		// Conversion to and from byte_length bytes in network order, for
+		// compact storage of addresses
+		void to_bytes(uint8_t* out) const {
+			for (int i = 0; i < 8; i++)
+			{
+				out[i]     = network >> (56 - i * 8);
+				out[i + 8] = host >> (56 - i * 8);
+			}
+		}
+
+		static IPv6 from_bytes(const uint8_t* in) {
+			uint64_t network = 0, host = 0;
+			for (int i = 0; i < 8; i++)
+			{
+				network = (network << 8) | in[i];
+				host    = (host << 8) | in[i + 8];
+			}
+			return IPv6(network, host);
+		}
+
+		// Prefix length of the largest block that starts at this address and
+		// does not extend past last (which must not be lower than this address)
+		short largest_block(const IPv6& last) const {
+#ifdef IPADDRESS_HAVE_INT128
+			uint128 size = last.wide() - wide();
+			int size_bits = 128;
+			if (~size != 0)
+			{
+				size++;
+				uint64_t high = static_cast<uint64_t>(size >> 64);
+				size_bits = high != 0 ? 127 - bits::leading_zeros(high) :
+					63 - bits::leading_zeros(static_cast<uint64_t>(size));
+			}
+#else
+			uint64_t size_host = last.host - host;
+			uint64_t size_network = last.network - network - (last.host < host ? 1 : 0);
+
+			int size_bits;
+			if (size_network == 0xffffffffffffffff && size_host == 0xffffffffffffffff)
+				size_bits = 128;
+			else
+			{
+				if (++size_host == 0) size_network++;
+				size_bits = size_network != 0 ? 127 - bits::leading_zeros(size_network) :
+					63 - bits::leading_zeros(size_host);
+			}
+#endif
+
+			int align_bits = host != 0 ? bits::trailing_zeros(host) :
+				network != 0 ? 64 + bits::trailing_zeros(network) : 128;
+			return 128 - (size_bits < align_bits ? size_bits : align_bits);
+		}
+
+		// Buffers passed to the format functions below must be at least this long
+		static const int max_string_length = 45;
+		static const int min_string_length = 2;  // "::"
+
 		// eg. "2001:db8::1020:ff"
-		std::string to_string() const {
-			segment_vector segments = segmentize();
-			return collapse(segments.begin(), segments.end());
+		char* format(char* out) const {
+			uint16_t segments[8];
+			segmentize(segments);
+			return collapse(segments, segments + 8, out);
 		}
 
 		// eg. "2001:db8::16.32.0.255"
-		std::string to_string_v4_mapped() const {
-			segment_vector segments = segmentize();
-			std::string v6part = collapse(segments.begin(), segments.end() - 2);
+		char* format_v4_mapped(char* out) const {
+			uint16_t segments[8];
+			segmentize(segments);
+			out = collapse(segments, segments + 6, out);
 
 			// If there is a "::" at the end, we don't add another
-			return v6part + (*(v6part.end() - 1) == ':' ? "" : ":") +
-				IPv4((segments[6] << 16) | segments[7]).to_string();
+			if (*(out - 1) != ':')
+				*out++ = ':';
+			return IPv4((segments[6] << 16) | segments[7]).format(out);
 		}
 
 		// eg. "2001:0db8:0000:0000:0000:0000:1020:00ff"
-		std::string to_string_full() const {
-			std::stringstream buf;
+		char* format_full(char* out) const {
+			uint16_t segments[8];
+			segmentize(segments);
 
-			// A local lambda to print a single address part, ommiting the trailing ":"
-			auto print_part = [&buf] (uint64_t part) { for (int i = 15; i >= 0; i--)
+			for (int i = 0; i < 8; i++)
 			{
-				buf << std::hex << ((part >> i*4) & 0xf);
-				if (!(i % 4) && (i != 0))
-					buf << ":";
-			}};
+				out = format_hex(segments[i], out, 4);
+				if (i != 7)
+					*out++ = ':';
+			}
+			return out;
+		}
+
+		std::string to_string() const {
+			char buf[max_string_length];
+			return std::string(buf, format(buf));
+		}
 
-			print_part(network);
-			buf << ":";
-			print_part(host);
+		std::string to_string_v4_mapped() const {
+			char buf[max_string_length];
+			return std::string(buf, format_v4_mapped(buf));
+		}
 
-			return buf.str();
+		std::string to_string_full() const {
+			char buf[max_string_length];
+			return std::string(buf, format_full(buf));
 		};
 
 		IPv6() : network(0), host(0) {};
 		IPv6(uint64_t network_, uint64_t host_) : 
 		network(network_), host(host_) {};
 
-		IPv6(std::string::const_iterator begin, 
+		IPv6(std::string::const_iterator begin,
 			std::string::const_iterator end) {
-				parse(begin, end);
+				if (!parse(begin, end))
+					throw std::runtime_error(parse_error(begin, end));
+		}
+
+		IPv6(const char* begin, const char* end) {
+			if (!parse(begin, end))
+				throw std::runtime_error(parse_error(begin, end));
+		}
+
+		// Non-throwing counterpart of the parsing constructors, for callers that
+		// expect invalid input. Returns false if the text is not a valid address.
+		template<typename Iterator>
+		static bool try_parse(Iterator begin, Iterator end, IPv6& address) {
+			return address.parse(begin, end);
+		}
+
+		// Describes a failed parse. Only built when the error is reported.
+		template<typename Iterator>
+		static std::string parse_error(Iterator begin, Iterator end) {
+			return "Invalid IPv6 format (" + std::string(begin, end) + ")";
 		}
 
 		static IPv6 prefix_6to4(const IPv4& a)
@@ -448,10 +771,13 @@ namespace IPAddress {
 				(static_cast<uint64_t>(a.value) << 16), 0);
 		}
 
-		IPv6 next(const short prefix = bit_length)
+		IPv6 next(const short prefix = bit_length) const
 		{
 			if (prefix < 0 || prefix > bit_length) 
 				throw std::runtime_error("Invalid prefix size");
+#ifdef IPADDRESS_HAVE_INT128
+			return from_wide(wide() + (~mask(prefix) + 1));
+#else
 			if (prefix <= 64) 
 				return IPv6(network + 
 				( static_cast<uint64_t>(0x1) << (64 - prefix)), host);
@@ -460,12 +786,16 @@ namespace IPAddress {
 				uint64_t newhost = host + (static_cast<uint64_t>(0x1) << (128 - prefix));
 				return IPv6(network + (newhost < host ? 1 : 0), newhost);
 			}
+#endif
 		}
 
-		IPv6 previous(const short prefix = bit_length)
+		IPv6 previous(const short prefix = bit_length) const
 		{
 			if (prefix < 0 || prefix > bit_length) 
 				throw std::runtime_error("Invalid prefix size");
+#ifdef IPADDRESS_HAVE_INT128
+			return from_wide(wide() - (~mask(prefix) + 1));
+#else
 			if (prefix <= 64) 
 				return IPv6(network - 
 				( static_cast<uint64_t>(0x1) << (64 - prefix)), host);
@@ -474,12 +804,25 @@ namespace IPAddress {
 				uint64_t newhost = host - (static_cast<uint64_t>(0x1) << (128 - prefix));
 				return IPv6(network - (newhost > host ? 1 : 0), newhost);
 			}
+#endif
 		}
 
 		IPv6(const std::string& text) {
-			parse(text.cbegin(),text.cend());
+			if (!parse(text.cbegin(), text.cend()))
+				throw std::runtime_error(parse_error(text.cbegin(), text.cend()));
 		};
 
+#ifdef IPADDRESS_HAVE_INT128
+		bool operator < (const IPv6& a) const
+		{
+			return wide() < a.wide();
+		};
+
+		bool operator > (const IPv6& a) const
+		{
+			return wide() > a.wide();
+		};
+#else
 		bool operator < (const IPv6& a) const
 		{
 			return (network < a.network) || 
@@ -491,6 +834,7 @@ namespace IPAddress {
 			return (network > a.network) || 
 				(network == a.network && host > a.host);
 		};
+#endif
 
 		bool operator <= (const IPv6& a) const
 		{
@@ -0,0 +1,242 @@
+/*
+InputStream.h - input that is read on a separate thread and handed over
+				in blocks, so that reading it overlaps with parsing it
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include<vector>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+#include<exception>
+#include<stdexcept>
+#include<cstdio>
+#include<cerrno>
+
+#ifndef _WIN32
+	#include<unistd.h>
+	#include<poll.h>
+#endif
+
+// Blocks are filled by a reader on the stream's own thread and passed to the
+// consumer in order through a ring of block_count buffers. The block that the
+// consumer holds is not reused until it asks for the next one, so it can be
+// parsed in place. A reader that can wait for input indefinitely must be
+// given a canceller, which makes it return, so that the stream can be
+// destroyed before the end of the input (such as after a parse error).
+
+class InputStream
+{
+public:
+	// Fills a buffer with at most size bytes of input and returns how many,
+	// or 0 at the end of the input. Errors are thrown, and rethrown to the
+	// consumer once it has received all the blocks read before the error.
+	typedef std::function<size_t(char* buffer, size_t size)> Reader;
+
+	// Makes a read that is in progress return soon, with 0 or an error. It is
+	// called from the consumer's thread.
+	typedef std::function<void()> Canceller;
+
+	static const size_t block_size = 1 << 20;
+	static const size_t block_count = 4;
+
+private:
+	Reader reader_;
+	Canceller canceller_;
+	std::vector<std::vector<char>> blocks_;
+	std::vector<size_t> sizes_;
+	size_t first_;
+	size_t filled_;
+	bool held_;
+	bool finished_;
+	bool cancelled_;
+	std::exception_ptr error_;
+	std::mutex mutex_;
+	std::condition_variable changed_;
+	std::thread thread_;
+
+	InputStream(const InputStream&);
+	InputStream& operator = (const InputStream&);
+
+	void produce()
+	{
+		try
+		{
+			for (size_t block = 0; ; block = (block + 1) % block_count)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					changed_.wait(lock, [&] { return cancelled_ || filled_ + held_ < block_count; });
+					if (cancelled_)
+						return;
+				}
+
+				size_t size = reader_(&blocks_[block][0], block_size);
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (size == 0)
+					finished_ = true;
+				else
+				{
+					sizes_[block] = size;
+					filled_++;
+				}
+				changed_.notify_all();
+
+				if (finished_)
+					return;
+			}
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			error_ = std::current_exception();
+			finished_ = true;
+			changed_.notify_all();
+		}
+	}
+
+public:
+	InputStream(const Reader& reader, const Canceller& canceller = Canceller()) :
+		reader_(reader), canceller_(canceller), blocks_(block_count, std::vector<char>(block_size)), sizes_(block_count, 0),
+		first_(0), filled_(0), held_(false), finished_(false), cancelled_(false)
+	{
+		thread_ = std::thread(&InputStream::produce, this);
+	}
+
+	~InputStream()
+	{
+		cancel();
+		thread_.join();
+	}
+
+	// Stops reading. Any following call to next() returns false.
+	void cancel()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			cancelled_ = true;
+			changed_.notify_all();
+		}
+		if (canceller_)
+			canceller_();
+	}
+
+	// Returns the next block, which stays valid until the following call, or
+	// false at the end of the input.
+	bool next(const char*& begin, const char*& end)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (held_)
+		{
+			held_ = false;
+			changed_.notify_all();
+		}
+
+		changed_.wait(lock, [&] { return filled_ != 0 || finished_ || cancelled_; });
+
+		if (filled_ == 0 || cancelled_)
+		{
+			if (error_ && !cancelled_)
+				std::rethrow_exception(error_);
+			return false;
+		}
+
+		begin = &blocks_[first_][0];
+		end = begin + sizes_[first_];
+		first_ = (first_ + 1) % block_count;
+		filled_--;
+		held_ = true;
+		return true;
+	}
+};
+
+// Reads a file as it is written, such as standard input or a named pipe.
+// Reads wait for the file together with a pipe that cancel() writes to, so
+// that a read that is waiting for data returns 0 when it is cancelled.
+class FileReader
+{
+private:
+	std::FILE* file_;
+#ifndef _WIN32
+	int wake_[2];
+#endif
+
+	FileReader(const FileReader&);
+	FileReader& operator = (const FileReader&);
+public:
+	FileReader(std::FILE* file) : file_(file)
+	{
+#ifndef _WIN32
+		if (pipe(wake_) != 0)
+			throw std::runtime_error("Cannot read input!");
+#endif
+	}
+
+	~FileReader()
+	{
+#ifndef _WIN32
+		close(wake_[0]);
+		close(wake_[1]);
+#endif
+	}
+
+	size_t read(char* buffer, size_t size)
+	{
+#ifndef _WIN32
+		// Unlike fread(), read() returns whatever has arrived so far instead
+		// of waiting for a whole block
+		pollfd files[2] = { { fileno(file_), POLLIN, 0 }, { wake_[0], POLLIN, 0 } };
+		for (;;)
+		{
+			if (poll(files, 2, -1) < 0)
+			{
+				if (errno != EINTR)
+					throw std::runtime_error("Cannot read input!");
+				continue;
+			}
+			if (files[1].revents != 0)
+				return 0;
+
+			ssize_t count = ::read(fileno(file_), buffer, size);
+			if (count >= 0)
+				return static_cast<size_t>(count);
+			if (errno != EINTR && errno != EAGAIN)
+				throw std::runtime_error("Cannot read input!");
+		}
+#else
+		// Reads cannot be interrupted here, so cancel() has no effect
+		size_t count = std::fread(buffer, 1, size, file_);
+		if (count == 0 && std::ferror(file_))
+			throw std::runtime_error("Cannot read input!");
+		return count;
+#endif
+	}
+
+	void cancel()
+	{
+#ifndef _WIN32
+		// The pipe stays readable, so every read after this returns at once
+		char wake = 0;
+		ssize_t written = write(wake_[1], &wake, 1);
+		(void) written;
+#endif
+	}
+};
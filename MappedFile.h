@@ -0,0 +1,222 @@
+/*
+MappedFile.h - read-only view of a whole input file, memory-mapped where
+			   possible so that it can be scanned in place
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include<string>
+#include<vector>
+#include<fstream>
+#include<iterator>
+#include<stdexcept>
+#include<cstring>
+#include<cstdio>
+
+#ifndef _WIN32
+	#include<sys/types.h>
+	#include<sys/stat.h>
+	#include<sys/mman.h>
+	#include<fcntl.h>
+	#include<unistd.h>
+#endif
+
+class MappedFile
+{
+private:
+	const char* data_;
+	size_t size_;
+	bool mapped_;
+
+	// Used for inputs that cannot be mapped (pipes, process substitution, or
+	// platforms without mmap)
+	std::vector<char> buffer_;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator = (const MappedFile&);
+
+	void read_whole(const std::string& file_name)
+	{
+		std::ifstream file_to_read(file_name, std::ios::binary);
+
+		if (!file_to_read)
+			throw std::runtime_error("Cannot read file!");
+
+		buffer_.assign(std::istreambuf_iterator<char>(file_to_read),
+			std::istreambuf_iterator<char>());
+		data_ = buffer_.empty() ? nullptr : &buffer_[0];
+		size_ = buffer_.size();
+	}
+
+public:
+	MappedFile(const std::string& file_name) :
+		data_(nullptr), size_(0), mapped_(false)
+	{
+#ifndef _WIN32
+		int fd = open(file_name.c_str(), O_RDONLY);
+
+		if (fd < 0)
+			throw std::runtime_error("Cannot read file!");
+
+		struct stat info;
+		if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+		{
+			size_ = info.st_size;
+
+			if (size_ == 0)
+			{
+				close(fd);
+				return;
+			}
+
+			void* address = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address != MAP_FAILED)
+			{
+				madvise(address, size_, MADV_SEQUENTIAL);
+				data_ = static_cast<const char*>(address);
+				mapped_ = true;
+			}
+		}
+
+		close(fd);
+
+		if (mapped_)
+			return;
+#endif
+		read_whole(file_name);
+	}
+
+	~MappedFile()
+	{
+#ifndef _WIN32
+		if (mapped_)
+			munmap(const_cast<char*>(data_), size_);
+#endif
+	}
+
+	const char* begin() const { return data_; }
+	const char* end() const { return data_ + size_; }
+	size_t size() const { return size_; }
+};
+
+// Whether a file has to be read as a stream rather than mapped: standard
+// input ("-"), named pipes, process substitution and the like
+inline bool is_stream(const std::string& file_name)
+{
+	if (file_name == "-")
+		return true;
+#ifndef _WIN32
+	struct stat info;
+	return stat(file_name.c_str(), &info) == 0 && !S_ISREG(info.st_mode);
+#else
+	return false;
+#endif
+}
+
+// Size of a file that can be mapped, or 0 for streams
+inline size_t input_size(const std::string& file_name)
+{
+	if (is_stream(file_name))
+		return 0;
+#ifndef _WIN32
+	struct stat info;
+	return stat(file_name.c_str(), &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+#else
+	std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+	return file ? static_cast<size_t>(file.tellg()) : 0;
+#endif
+}
+
+// A file that is read as a stream, or standard input for "-"
+class InputFile
+{
+private:
+	std::FILE* file_;
+	bool owns_file_;
+
+	InputFile(const InputFile&);
+	InputFile& operator = (const InputFile&);
+public:
+	InputFile(const std::string& file_name) :
+		file_(stdin), owns_file_(false)
+	{
+		if (file_name != "-")
+		{
+			file_ = std::fopen(file_name.c_str(), "rb");
+			if (file_ == nullptr)
+				throw std::runtime_error("Cannot read file!");
+			owns_file_ = true;
+		}
+	}
+
+	~InputFile()
+	{
+		if (owns_file_)
+			std::fclose(file_);
+	}
+
+	std::FILE* get() const { return file_; }
+};
+
+// Calls a function for every line in [begin, end), without the terminating
+// newline. The last line does not need to be terminated.
+
+template<typename Function>
+void for_each_line(const char* begin, const char* end, Function function)
+{
+	while (begin != end)
+	{
+		const char* line_end = static_cast<const char*>(memchr(begin, '\n', end - begin));
+
+		if (line_end == nullptr)
+		{
+			function(begin, end);
+			return;
+		}
+
+		function(begin, line_end);
+		begin = line_end + 1;
+	}
+}
+
+// Splits [begin, end) into at most count pieces of roughly equal size, each
+// made of whole lines, so that they can be processed independently. Returns
+// the boundaries between the pieces, including begin and end.
+
+inline std::vector<const char*> split_lines(const char* begin, const char* end, size_t count)
+{
+	std::vector<const char*> bounds(1, begin);
+
+	for (size_t i = 1; i < count; i++)
+	{
+		const char* split = begin + (end - begin) * i / count;
+
+		// A single line may span several of the evenly spaced split points
+		if (split < bounds.back())
+			continue;
+
+		const char* line_end = static_cast<const char*>(memchr(split, '\n', end - split));
+		if (line_end == nullptr || line_end + 1 == end)
+			break;
+
+		bounds.push_back(line_end + 1);
+	}
+
+	bounds.push_back(end);
+	return bounds;
+}
@@ -0,0 +1,164 @@
+/*
+OutputBuffer.h - large user-space output buffer shared by output adapters,
+				 written out in bulk to standard output or a file
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include<string>
+#include<vector>
+#include<cstdio>
+#include<cstring>
+#include<stdexcept>
+
+class OutputBuffer
+{
+private:
+	std::vector<char> buffer_;
+	size_t used_;
+	std::string file_name_;
+	std::FILE* target_;
+	bool owns_target_;
+	bool line_buffered_;
+	bool written_;
+
+	OutputBuffer(const OutputBuffer&);
+	OutputBuffer& operator = (const OutputBuffer&);
+
+	// A file is only created (or truncated) once there is output for it, or
+	// on flush(), so that it is left alone if the inputs cannot be read
+	void open()
+	{
+		if (target_ == nullptr)
+		{
+			target_ = std::fopen(file_name_.c_str(), "wb");
+			if (target_ == nullptr)
+				throw std::runtime_error("Cannot write file!");
+		}
+	}
+
+	void write_through(const char* data, size_t length)
+	{
+		open();
+		written_ = true;
+		if (std::fwrite(data, 1, length, target_) != length)
+			throw std::runtime_error("Cannot write output!");
+	}
+
+public:
+	static const size_t default_capacity = 1 << 20;
+
+	// Writes to standard output if file_name is empty. In line-buffered mode
+	// the buffer is flushed after every line, which is useful when the output
+	// is piped into an interactive program.
+	OutputBuffer(const std::string& file_name = std::string(), bool line_buffered = false) :
+		buffer_(default_capacity), used_(0), file_name_(file_name),
+		target_(file_name.empty() ? stdout : nullptr), owns_target_(!file_name.empty()),
+		line_buffered_(line_buffered), written_(false)
+	{
+	}
+
+	~OutputBuffer()
+	{
+		// Errors cannot be reported from here. Call flush() explicitly to find
+		// out whether all the output was written. A file that has not been
+		// opened yet is not created just for what is left in the buffer.
+		if (target_ == nullptr)
+			return;
+
+		try { flush(); } catch (...) {}
+
+		if (owns_target_)
+			std::fclose(target_);
+	}
+
+	void write(const char* data, size_t length)
+	{
+		if (used_ + length > buffer_.size())
+		{
+			flush();
+			if (length > buffer_.size())
+			{
+				write_through(data, length);
+				return;
+			}
+		}
+
+		memcpy(&buffer_[used_], data, length);
+		used_ += length;
+	}
+
+	void write(const std::string& data)
+	{
+		write(data.data(), data.size());
+	}
+
+	void put(char c)
+	{
+		if (used_ == buffer_.size())
+			flush();
+		buffer_[used_++] = c;
+	}
+
+	void write_number(unsigned int number)
+	{
+		char digits[10];
+		int count = 0;
+
+		do
+		{
+			digits[count++] = '0' + number % 10;
+			number /= 10;
+		} while (number != 0);
+
+		while (count > 0)
+			put(digits[--count]);
+	}
+
+	void end_line()
+	{
+		put('\n');
+		if (line_buffered_)
+			flush();
+	}
+
+	// Drops the buffered output, which is only possible while none of it has
+	// been written yet. Returns whether it was.
+	bool discard()
+	{
+		if (written_)
+			return false;
+		used_ = 0;
+		return true;
+	}
+
+	void flush()
+	{
+		open();
+
+		if (used_ != 0)
+		{
+			size_t length = used_;
+			used_ = 0;
+			write_through(&buffer_[0], length);
+		}
+
+		if (std::fflush(target_) != 0)
+			throw std::runtime_error("Cannot write output!");
+	}
+};
@@ -0,0 +1,84 @@
+/*
+PageAllocator.h - allocator for large arrays that takes memory directly
+				  from the operating system
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include<new>
+#include<cstddef>
+
+#ifndef _WIN32
+	#include<sys/mman.h>
+#endif
+
+// Large blocks are mapped on their own, so capacity that is reserved but
+// never written costs address space only, and are backed by transparent huge
+// pages where the system allows it, which cuts the number of page faults
+// when they are filled. Small blocks come from the regular heap.
+
+template<typename T>
+class PageAllocator
+{
+public:
+	typedef T value_type;
+
+	static const size_t large_block = 1 << 21;
+
+	PageAllocator() {};
+
+	template<typename U>
+	PageAllocator(const PageAllocator<U>&) {};
+
+	T* allocate(size_t count)
+	{
+		size_t bytes = count * sizeof(T);
+#ifndef _WIN32
+		if (bytes >= large_block)
+		{
+			void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (address == MAP_FAILED)
+				throw std::bad_alloc();
+	#ifdef MADV_HUGEPAGE
+			madvise(address, bytes, MADV_HUGEPAGE);
+	#endif
+			return static_cast<T*>(address);
+		}
+#endif
+		return static_cast<T*>(::operator new(bytes));
+	}
+
+	void deallocate(T* pointer, size_t count)
+	{
+#ifndef _WIN32
+		if (count * sizeof(T) >= large_block)
+		{
+			munmap(pointer, count * sizeof(T));
+			return;
+		}
+#endif
+		::operator delete(pointer);
+	}
+
+	template<typename U>
+	bool operator == (const PageAllocator<U>&) const { return true; }
+
+	template<typename U>
+	bool operator != (const PageAllocator<U>&) const { return false; }
+};
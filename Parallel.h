@@ -0,0 +1,65 @@
+/*
+Parallel.h - helpers for running independent pieces of work on
+			 multiple threads
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include<vector>
+#include<thread>
+#include<exception>
+
+// Number of threads to use when none was requested explicitly
+inline unsigned default_threads()
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	return threads == 0 ? 1 : threads;
+}
+
+// Calls function(i) for every i in [0, count), each on its own thread (the
+// first one on the calling thread), and waits for all of them to finish. If
+// any of the calls throws, the exception is rethrown once all have finished.
+
+template<typename Function>
+void parallel_for(size_t count, Function function)
+{
+	std::vector<std::exception_ptr> errors(count);
+	std::vector<std::thread> workers;
+	workers.reserve(count);
+
+	auto run = [&](size_t i) {
+		try { function(i); }
+		catch (...) { errors[i] = std::current_exception(); }
+	};
+
+	for (size_t i = 1; i < count; i++)
+	{
+		try { workers.push_back(std::thread(run, i)); }
+		catch (...) { run(i); }
+	}
+
+	if (count > 0)
+		run(0);
+
+	for (auto& worker : workers)
+		worker.join();
+
+	for (auto& error : errors)
+		if (error)
+			std::rethrow_exception(error);
+}
@@ -0,0 +1,118 @@
+/*
+RadixSort.h - in-place MSD radix sort for records with fixed-length
+			  byte-string keys (such as IP addresses)
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include<algorithm>
+#include<cstddef>
+#include<cstdint>
+
+// Key of a sortable record. Specializations must provide:
+//     static const int length;                        // number of key bytes
+//     static uint8_t byte(const Record& r, int i);    // most significant first
+// and Record::operator < must order records in the same way as their keys.
+
+template<typename Record>
+struct radix_key;
+
+namespace radix_detail
+{
+	// Below this size buckets are finished off with insertion sort
+	const ptrdiff_t insertion_threshold = 32;
+
+	template<typename Record>
+	void insertion_sort(Record* begin, Record* end)
+	{
+		for (Record* i = begin + 1; i < end; ++i)
+		{
+			Record value = *i;
+			Record* j = i;
+			for (; j != begin && value < *(j - 1); --j)
+				*j = *(j - 1);
+			*j = value;
+		}
+	}
+
+	template<typename Record>
+	void sort(Record* begin, Record* end, int byte)
+	{
+		typedef radix_key<Record> key;
+
+		while (byte < key::length)
+		{
+			if (end - begin <= insertion_threshold)
+			{
+				insertion_sort(begin, end);
+				return;
+			}
+
+			size_t count[256] = {};
+			for (Record* i = begin; i != end; ++i)
+				count[key::byte(*i, byte)]++;
+
+			// All records share this byte (eg. the upper bytes of the address
+			// space a table covers), so there is nothing to do on this level.
+			if (count[key::byte(*begin, byte)] == static_cast<size_t>(end - begin))
+			{
+				byte++;
+				continue;
+			}
+
+			// American flag sort - records are swapped directly into their
+			// buckets, so no scratch buffer is needed.
+			Record* bucket_start[256];
+			Record* bucket_next[256];
+			Record* position = begin;
+			for (int b = 0; b < 256; b++)
+			{
+				bucket_start[b] = bucket_next[b] = position;
+				position += count[b];
+			}
+
+			for (int b = 0; b < 256; b++)
+			{
+				Record* bucket_end = bucket_start[b] + count[b];
+				while (bucket_next[b] != bucket_end)
+				{
+					Record value = *bucket_next[b];
+					int digit = key::byte(value, byte);
+					while (digit != b)
+					{
+						std::swap(value, *bucket_next[digit]++);
+						digit = key::byte(value, byte);
+					}
+					*bucket_next[b]++ = value;
+				}
+			}
+
+			for (int b = 0; b < 256; b++)
+				if (count[b] > 1)
+					sort(bucket_start[b], bucket_start[b] + count[b], byte + 1);
+			return;
+		}
+	}
+}
+
+template<typename Record>
+void radix_sort(Record* begin, Record* end)
+{
+	if (end - begin > 1)
+		radix_detail::sort(begin, end, 0);
+}
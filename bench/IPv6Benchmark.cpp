@@ -0,0 +1,130 @@
+/*
+IPv6Benchmark.cpp - microbenchmark of the IPv6 address arithmetic in
+					IPAddress.h
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<iostream>
+#include<string>
+#include<vector>
+#include<random>
+#include<chrono>
+#include<cstdlib>
+#include<cstdint>
+#include<iterator>
+#include<stdexcept>
+
+#include<IPAddress.h>
+
+using IPAddress::IPv6;
+
+// The same program is built once with unsigned __int128 and once with
+// -DIPADDRESS_NO_INT128 (see the ipv6bench target of the Makefile), so that
+// the two backends are timed on identical work. The checksums printed by
+// both builds must match.
+
+#ifdef IPADDRESS_HAVE_INT128
+	const char* backend = "__int128";
+#else
+	const char* backend = "two 64-bit words";
+#endif
+
+struct Prefix
+{
+	IPv6 address;
+	short length;
+};
+
+// Addresses in global unicast space (2000::/3) with the prefix lengths that
+// are common in IPv6 routing tables, mostly /32 to /48
+std::vector<Prefix> generate_prefixes(size_t count, unsigned seed)
+{
+	static const short lengths[] = { 19, 24, 28, 29, 32, 33, 36, 40, 44, 46, 47, 48, 56, 64, 128 };
+	static const double weights[] = { 0.1, 0.3, 0.5, 2, 8, 1, 3, 4, 5, 2, 1, 50, 3, 2, 0.5 };
+
+	std::mt19937_64 random(seed);
+	std::discrete_distribution<int> length(std::begin(weights), std::end(weights));
+
+	std::vector<Prefix> prefixes(count);
+	for (auto& prefix : prefixes)
+	{
+		uint64_t network = (random() >> 3) | (static_cast<uint64_t>(1) << 61);
+		prefix.address = IPv6(network, random());
+		prefix.length = lengths[length(random)];
+	}
+	return prefixes;
+}
+
+template<typename Operation>
+void run(const char* name, const std::vector<Prefix>& prefixes, const Operation& operation)
+{
+	// Milliseconds of the fastest of five runs over all the prefixes
+	double best = 0;
+	uint64_t checksum = 0;
+	for (int run = 0; run < 5; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t sum = 0;
+		for (size_t i = 0; i + 1 < prefixes.size(); i++)
+			sum += operation(prefixes[i], prefixes[i + 1]);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (run == 0 || elapsed.count() < best)
+			best = elapsed.count();
+		checksum = sum;
+	}
+
+	std::cout << name << best << " ms  (checksum " << std::hex << checksum << std::dec << ")" << std::endl;
+}
+
+inline uint64_t fold(const IPv6& ip)
+{
+	return ip.network ^ (ip.host * 31);
+}
+
+int main(int argc, char *argv[])
+{
+	// ipv6bench [count] times the operations on count prefixes (2M by default)
+
+	try {
+		size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 0;
+		std::vector<Prefix> prefixes = generate_prefixes(count ? count : 2000000, 1);
+
+		std::cout << "IPv6 arithmetic with " << backend << ", " << prefixes.size() << " prefixes" << std::endl;
+
+		run("mask + next         ", prefixes, [](const Prefix& a, const Prefix&) {
+			return fold(a.address.network_zeros(a.length).next(a.length)) ^ fold(a.address.network_ones(a.length));
+		});
+
+		run("compare + previous  ", prefixes, [](const Prefix& a, const Prefix& b) {
+			return (a.address < b.address ? fold(a.address.previous()) : fold(b.address.previous())) +
+				(a.address <= b.address);
+		});
+
+		run("largest_block       ", prefixes, [](const Prefix& a, const Prefix& b) {
+			const IPv6& low = a.address < b.address ? a.address : b.address;
+			const IPv6& high = a.address < b.address ? b.address : a.address;
+			return static_cast<uint64_t>(low.network_zeros(a.length).largest_block(high));
+		});
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+/*
+SweepBenchmark.cpp - times the sweep of BgpCompare.cpp over two sorted
+					 tables with the kernel and adapter types known at compile
+					 time and with them called through virtual functions
+
+Coded by agent <agent@local>, 2026
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include<chrono>
+#include<random>
+#include<cstdlib>
+
+#define BGPCOMPARE_NO_MAIN
+#include<BgpCompare.cpp>
+
+// Only the traversal is timed: both tables are generated and sorted first,
+// and the output goes to /dev/null. The virtual variant wraps the same
+// kernels and adapters in classes that call them through a base class, with
+// empty() decided at run time, which is how the sweep called them before it
+// was templated on their types.
+
+class DynamicKernel
+{
+public:
+	virtual ~DynamicKernel() {};
+	virtual bool operator ()(const int A, const int B) const = 0;
+};
+
+template<typename Kernel>
+class DynamicKernelOf : public DynamicKernel
+{
+public:
+	virtual bool operator ()(const int A, const int B) const { return Kernel()(A, B); }
+};
+
+class KernelRef
+{
+private:
+	const DynamicKernel& kernel_;
+public:
+	KernelRef(const DynamicKernel& kernel) : kernel_(kernel) {};
+
+	bool operator ()(const int A, const int B) const { return kernel_(A, B); }
+};
+
+template<typename T>
+class DynamicAdapter
+{
+public:
+	virtual ~DynamicAdapter() {};
+	virtual void operator ()(const IPNode<T>& node) const = 0;
+	virtual bool empty() const { return false; };
+};
+
+template<typename T, typename Adapter>
+class DynamicAdapterOf : public DynamicAdapter<T>
+{
+private:
+	Adapter adapter_;
+public:
+	DynamicAdapterOf(const Adapter& adapter) : adapter_(adapter) {};
+
+	virtual void operator ()(const IPNode<T>& node) const { adapter_(node); }
+	virtual bool empty() const { return adapter_.empty(); }
+};
+
+template<typename T>
+class AdapterRef : public OutputAdapter<T>
+{
+private:
+	const DynamicAdapter<T>& adapter_;
+public:
+	AdapterRef(const DynamicAdapter<T>& adapter) : adapter_(adapter) {};
+
+	void operator ()(const IPNode<T>& node) const { adapter_(node); }
+	bool empty() const { return adapter_.empty(); }
+};
+
+template<typename T>
+T random_address(std::mt19937_64& random);
+
+// Unicast space, with the prefix lengths of a full table, mostly /24s
+template<>
+IPAddress::IPv4 random_address<IPAddress::IPv4>(std::mt19937_64& random)
+{
+	return IPAddress::IPv4(static_cast<uint32_t>(random() % 0xdf000000) + 0x01000000);
+}
+
+template<typename T>
+short random_length(std::mt19937_64& random);
+
+template<>
+short random_length<IPAddress::IPv4>(std::mt19937_64& random)
+{
+	static const short lengths[] = { 8, 12, 16, 18, 19, 20, 21, 22, 23, 24 };
+	static const double weights[] = { 0.02, 0.1, 1.5, 1.3, 2.5, 4, 5, 11, 10, 58 };
+	static std::discrete_distribution<int> length(std::begin(weights), std::end(weights));
+	return lengths[length(random)];
+}
+
+// Global unicast space (2000::/3), mostly /32s to /48s
+template<>
+IPAddress::IPv6 random_address<IPAddress::IPv6>(std::mt19937_64& random)
+{
+	uint64_t network = (random() >> 3) | (static_cast<uint64_t>(1) << 61);
+	return IPAddress::IPv6(network, random());
+}
+
+template<>
+short random_length<IPAddress::IPv6>(std::mt19937_64& random)
+{
+	static const short lengths[] = { 19, 24, 28, 29, 32, 33, 36, 40, 44, 46, 47, 48, 56, 64, 128 };
+	static const double weights[] = { 0.1, 0.3, 0.5, 2, 8, 1, 3, 4, 5, 2, 1, 50, 3, 2, 0.5 };
+	static std::discrete_distribution<int> length(std::begin(weights), std::end(weights));
+	return lengths[length(random)];
+}
+
+template<typename T>
+IPInterval<T> random_interval(std::mt19937_64& random)
+{
+	short length = random_length<T>(random);
+	return IPInterval<T>(random_address<T>(random).network_zeros(length), length);
+}
+
+// Table B is table A with a tenth of its prefixes dropped and as many new
+// ones added, so that every operation has output.
+template<typename T>
+void generate_tables(size_t count, IntervalVector<T>& a, IntervalVector<T>& b)
+{
+	std::mt19937_64 random(1);
+	for (size_t i = 0; i < count; i++)
+	{
+		IPInterval<T> interval = random_interval<T>(random);
+		a.push_back(interval);
+		if (random() % 10 != 0)
+			b.push_back(interval);
+		else
+			b.push_back(random_interval<T>(random));
+	}
+	sort_intervals(a);
+	sort_intervals(b);
+}
+
+template<typename Sweep>
+double best_time(const Sweep& sweep)
+{
+	// Milliseconds of the fastest of ten runs
+	double best = 0;
+	for (int run = 0; run < 10; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		sweep();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (run == 0 || elapsed.count() < best)
+			best = elapsed.count();
+	}
+	return best;
+}
+
+// The virtual kernel and adapters are reached through volatile pointers, so
+// that the compiler cannot resolve the calls through them
+
+template<typename T, typename Kernel>
+void benchmark(const char* name, const IntervalVector<T>& a, const IntervalVector<T>& b,
+	OutputBuffer& output)
+{
+	Kernel kernel;
+	DynamicKernelOf<Kernel> dynamic_kernel_of;
+	const DynamicKernel* volatile dynamic_kernel = &dynamic_kernel_of;
+	double specialised, dynamic;
+
+	if (kernel.symetric())
+	{
+		specialised = best_time([&]() {
+			traverse<T>(MarkerMerge<T>(a, b), kernel, SimpleAdapter<T>(output));
+		});
+
+		DynamicAdapterOf<T, SimpleAdapter<T>> simple((SimpleAdapter<T>(output)));
+		DynamicAdapterOf<T, EmptyOutputAdapter<T>> empty((EmptyOutputAdapter<T>()));
+		const DynamicAdapter<T>* volatile adapter_a = &simple;
+		const DynamicAdapter<T>* volatile adapter_b = &empty;
+		dynamic = best_time([&]() {
+			traverse<T>(MarkerMerge<T>(a, b), KernelRef(*dynamic_kernel),
+				AdapterRef<T>(*adapter_a), AdapterRef<T>(*adapter_b));
+		});
+	}
+	else
+	{
+		specialised = best_time([&]() {
+			traverse<T>(MarkerMerge<T>(a, b), kernel,
+				DiffAdapter<T>(output, "+"), DiffAdapter<T>(output, "-"));
+		});
+
+		DynamicAdapterOf<T, DiffAdapter<T>> plus(DiffAdapter<T>(output, "+"));
+		DynamicAdapterOf<T, DiffAdapter<T>> minus(DiffAdapter<T>(output, "-"));
+		const DynamicAdapter<T>* volatile adapter_a = &plus;
+		const DynamicAdapter<T>* volatile adapter_b = &minus;
+		dynamic = best_time([&]() {
+			traverse<T>(MarkerMerge<T>(a, b), KernelRef(*dynamic_kernel),
+				AdapterRef<T>(*adapter_a), AdapterRef<T>(*adapter_b));
+		});
+	}
+	output.flush();
+
+	std::cout << name << "specialised " << specialised << " ms, virtual " << dynamic << " ms" << std::endl;
+}
+
+template<typename T>
+void benchmark_family(const char* family, size_t count, OutputBuffer& output)
+{
+	IntervalVector<T> a, b;
+	generate_tables<T>(count, a, b);
+	std::cout << family << ", " << count << " prefixes per table" << std::endl;
+
+	benchmark<T, DifferenceKernel>("  diff          ", a, b, output);
+	benchmark<T, UnionKernel>("  union         ", a, b, output);
+	benchmark<T, IntersectionKernel>("  intersection  ", a, b, output);
+}
+
+int main(int argc, char *argv[])
+{
+	// sweepbench [ipv4 count] [ipv6 count] times every operation on generated
+	// tables (1M IPv4 and 200k IPv6 prefixes by default)
+
+	try {
+		size_t count4 = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 0;
+		size_t count6 = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0;
+		OutputBuffer output("/dev/null");
+
+		benchmark_family<IPAddress::IPv4>("IPv4", count4 ? count4 : 1000000, output);
+		benchmark_family<IPAddress::IPv6>("IPv6", count6 ? count6 : 200000, output);
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}